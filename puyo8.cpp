@@ -3,1216 +3,1113 @@
 #include <cstdlib>
 #include <ctime>
 #include <unistd.h>
+#include <poll.h>
 #include <vector>
+#include <deque>
 #include <set>
-#include <fstream>
 #include <algorithm>
 #include <string>
+#include <cstdint>
+#include <cstring>
+#include "puyoengine.h"
+#include "puyobot.h"
+#include "puyoreplay.h"
+#include "puyobench.h"
+#include "puyoscore.h"
+#include <sys/stat.h>
 
-class PuyoArray;
-class PuyoArrayActive;
-class PuyoArrayStack;
-class PuyoControl;
 class PuyoGame;
 
-// ぷよの色を表すの列挙型
-// NONEが無し，RED,BLUE,..が色を表す
-enum puyocolor
-{
-	NONE,
-	RED,
-	BLUE,
-	GREEN,
-	YELLOW,
-	PURPLE
-};
-
-class PuyoArray
+// Incremental terminal renderer
+// Remembers every character it put on the screen and only emits the
+// cells that differ from the last frame
+class PuyoRenderer
 {
 public:
-	PuyoArray() : data(NULL), data_line(0), data_column(0) {}
-
-	~PuyoArray()
+	// Color pairs; puyos use their puyocolor value as the pair number
+	enum
 	{
-		Release();
-	}
+		PAIR_SCORE = PURPLE + 1,
+		PAIR_HIGHSCORE
+	};
 
-	void ChangeSize(unsigned int line, unsigned int column)
+	// Initialize color pairs (once, after start_color())
+	static void Init()
 	{
-		Release();
-		data = new puyocolor[line * column];
-		data_line = line;
-		data_column = column;
+		init_pair(RED, COLOR_RED, COLOR_BLACK);
+		init_pair(BLUE, COLOR_BLUE, COLOR_BLACK);
+		init_pair(GREEN, COLOR_GREEN, COLOR_BLACK);
+		init_pair(YELLOW, COLOR_YELLOW, COLOR_BLACK);
+		init_pair(PURPLE, COLOR_MAGENTA, COLOR_BLACK);
+		init_pair(PAIR_SCORE, COLOR_CYAN, COLOR_BLACK);
+		init_pair(PAIR_HIGHSCORE, COLOR_MAGENTA, COLOR_WHITE);
 	}
 
-	unsigned int GetLine()
+	// Character and color attribute of a puyo
+	static chtype Glyph(puyocolor color)
 	{
-		return data_line;
+		static const char glyphs[] = {'.', 'R', 'B', 'G', 'Y', 'P'};
+		if (color > PURPLE)
+		{
+			return '?';
+		}
+		return glyphs[color] | COLOR_PAIR(color);
 	}
 
-	unsigned int GetColumn()
+	// Forget what is on the screen; call after clear() or a resize
+	void Invalidate()
 	{
-		return data_column;
+		screen.assign(LINES * COLS, 0);
+		screen_column = COLS;
 	}
 
-	puyocolor GetValue(unsigned int y, unsigned int x)
+	void DrawCell(int y, int x, chtype ch)
 	{
-		if (y >= GetLine() || x >= GetColumn())
+		if (y < 0 || x < 0 || x >= screen_column || y * screen_column + x >= (int)screen.size())
 		{
-			// 引数の値が正しくない
-			return NONE;
+			return;
 		}
-		return data[y * GetColumn() + x];
-	}
-
-	void SetValue(unsigned int y, unsigned int x, puyocolor puyodata)
-	{
-		if (y >= GetLine() || x >= GetColumn())
+		chtype &cell = screen[y * screen_column + x];
+		if (cell == ch)
 		{
-			// 引数の値が正しくない
 			return;
 		}
-		data[y * GetColumn() + x] = puyodata;
+		cell = ch;
+		mvaddch(y, x, ch);
 	}
 
-	int CountPuyo()
+	void DrawText(int y, int x, chtype attr, const char *text)
 	{
-		int count = 0;
-		for (int y = 0; y < GetLine(); y++)
+		for (int i = 0; text[i] != '\0'; i++)
 		{
-			for (int x = 0; x < GetColumn(); x++)
-			{
-				if (GetValue(y, x) != NONE)
-				{
-					count++;
-				}
-			}
+			DrawCell(y, x + i, (unsigned char)text[i] | attr);
 		}
-		return count;
 	}
 
 private:
-	puyocolor *data;
-	unsigned int data_line;
-	unsigned int data_column;
+	std::vector<chtype> screen;
+	int screen_column;
+};
 
-	void Release()
+// Histogram of non-negative samples (microseconds, counts) in logarithmic buckets
+// Each power of two is split into four buckets, so percentiles are within 25%
+// of the true value while Add() stays a couple of instructions
+class PuyoHistogram
+{
+public:
+	PuyoHistogram()
 	{
-		if (data == NULL)
-		{
-			return;
-		}
-		delete[] data;
-		data = NULL;
+		Clear();
 	}
-};
 
-class PuyoArrayActive : public PuyoArray
-{
-private:
-	int puyorotate;
-	puyocolor *nextpuyo;
+	void Clear()
+	{
+		memset(buckets, 0, sizeof(buckets));
+		count = 0;
+		max = 0;
+	}
 
-	void ReleaseNextPuyo()
+	void Add(uint64_t value)
 	{
-		if (nextpuyo == NULL)
+		buckets[Bucket(value)]++;
+		count++;
+		if (value > max)
 		{
-			return;
+			max = value;
 		}
-		delete[] nextpuyo;
-		nextpuyo = NULL;
 	}
 
-public:
-	PuyoArrayActive()
+	uint64_t GetCount() const
 	{
-		puyorotate = 0;
-		nextpuyo = new puyocolor[3 * 2];
+		return count;
 	}
 
-	~PuyoArrayActive()
+	uint64_t GetMax() const
 	{
-		ReleaseNextPuyo();
+		return max;
 	}
 
-	int GetPuyoRotate() const
+	// Upper bound of the bucket that holds the given fraction (0 to 1) of the samples
+	uint64_t Percentile(double fraction) const
 	{
-		return puyorotate;
-	}
-	void SetPuyoRate(int rotate)
-	{
-		puyorotate = rotate;
+		uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKET_NUMBER; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+			{
+				return std::min(UpperBound(i), max);
+			}
+		}
+		return max;
 	}
 
-	puyocolor GetNextPuyoValue(unsigned int y, unsigned int x)
+private:
+	static const int BUCKET_NUMBER = 64 * 4;
+	uint64_t buckets[BUCKET_NUMBER];
+	uint64_t count;
+	uint64_t max;
+
+	// Values below 4 get a bucket each; above that, the top three bits pick the bucket
+	static int Bucket(uint64_t value)
 	{
-		if (y >= 3 || x >= 3)
+		if (value < 4)
 		{
-			// 引数の値が正しくない
-			return NONE;
+			return static_cast<int>(value);
 		}
-		return nextpuyo[y * 2 + x];
+		int high = 63 - __builtin_clzll(value);
+		return (high - 1) * 4 + static_cast<int>((value >> (high - 2)) & 3);
 	}
 
-	void SetNextPuyoValue(unsigned int y, unsigned int x, puyocolor puyodata)
+	static uint64_t UpperBound(int bucket)
 	{
-		if (y >= 3 || x >= 3)
+		if (bucket < 4)
 		{
-			// 引数の値が正しくない
-			return;
+			return bucket;
 		}
-		nextpuyo[y * 2 + x] = puyodata;
+		int high = bucket / 4 + 1;
+		uint64_t lower = static_cast<uint64_t>(4 + bucket % 4) << (high - 2);
+		return lower + (1ULL << (high - 2)) - 1;
 	}
 };
 
-class PuyoArrayStack : public PuyoArray
+// Queue of chain animations that the game loop plays one frame at a time
+// The rules resolve a chain step at once; each clip keeps a copy of the field
+// right after its step, so keys are still read while the frames go by
+class PuyoTimeline
 {
-private:
-	int score;
-	int nowscore;
-
 public:
-	PuyoArrayStack()
+	enum Kind
+	{
+		// Vanished puyos blink on and off
+		BLINK,
+		// Floating puyos drop one row per frame
+		FALL,
+		// The chain emptied the field; "ALL CLEAR!" appears and stays until the next pair lands
+		ALL_CLEAR
+	};
+
+	struct Clip
+	{
+		Kind kind;
+		// Field after the step: vanished puyos removed, floating puyos landed
+		PuyoPackedField field;
+		// BLINK: the groups, and their cells in the same order
+		std::vector<PuyoGroup> groups;
+		std::vector<unsigned int> cells;
+		// FALL: every puyo that moved
+		std::vector<PuyoFall> falls;
+		int frames;
+		// Milliseconds each frame stays on screen
+		int frameTime;
+	};
+
+	PuyoTimeline() : start(0) {}
+
+	// Queue a clip behind the others; it starts now if nothing is playing
+	// Returns the clip for the caller to fill in
+	Clip &Push(Kind kind, int frames, int frameTime, long long now)
 	{
-		score = 0;
-		nowscore = 0;
+		if (clips.empty())
+		{
+			start = now;
+		}
+		clips.push_back(Clip());
+		Clip &clip = clips.back();
+		clip.kind = kind;
+		clip.frames = frames;
+		clip.frameTime = frameTime;
+		return clip;
 	}
-	int GetScore() const
+
+	// Drop the clips that finished by now; the next one starts where the last ended
+	void Advance(long long now)
 	{
-		return score;
+		while (!clips.empty() && now >= start + (long long)clips.front().frames * clips.front().frameTime)
+		{
+			start += (long long)clips.front().frames * clips.front().frameTime;
+			clips.pop_front();
+		}
 	}
-	void AddScore(int num)
+
+	// Shift the remaining frames later, e.g. by the time the game was paused
+	void Delay(long long milliseconds)
 	{
-		score += num;
+		start += milliseconds;
 	}
-	void SetScore(int num)
+
+	void Clear()
 	{
-		score = num;
+		clips.clear();
 	}
 
-	int GetNowscore() const
+	bool IsEmpty() const
 	{
-		return nowscore;
+		return clips.empty();
 	}
-	void SetNowScore(int num)
+
+	const Clip &GetClip() const
 	{
-		nowscore = num;
+		return clips.front();
 	}
-};
 
-class PuyoControl
-{
-public:
-	void GeneratePuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	// Frame of the current clip that is due now (0 to frames - 1)
+	int GetFrame(long long now) const
 	{
-		if (stack.GetValue(0, 5) != NONE || stack.GetValue(0, 6) != NONE)
-		{
-			return;
-		}
-
-		active.SetPuyoRate(0);
-		SetChainCount(0);
-
-		GenerateNextPuyo(active, stack);
+		const Clip &clip = clips.front();
+		long long frame = (now - start) / clip.frameTime;
+		return static_cast<int>(std::max(0LL, std::min<long long>(frame, clip.frames - 1)));
+	}
 
-		active.SetValue(0, 5, active.GetNextPuyoValue(0, 0));
-		active.SetValue(0, 6, active.GetNextPuyoValue(0, 1));
-		// active.SetValue(0, 5, RED);
-		// active.SetValue(0, 6, BLUE);
+	// When the frame after the current one is due
+	long long GetNextFrameTime(long long now) const
+	{
+		return start + (long long)(GetFrame(now) + 1) * clips.front().frameTime;
 	}
 
 private:
-	void GenerateNextPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	std::deque<Clip> clips;
+	// When the first clip in the queue started
+	long long start;
+};
+
+// ゲーム画面 (curses) とアニメーション
+// ルールはPuyoControlに任せ，その通知を受けて表示と待ち時間を挟む
+class PuyoGame : public PuyoControlListener
+{
+public:
+	PuyoGame()
 	{
-		if (active.GetNextPuyoValue(1, 0) == NONE || active.GetNextPuyoValue(1, 1) == NONE)
-		{
-			active.SetNextPuyoValue(0, 0, RandomColor());
-			active.SetNextPuyoValue(0, 1, RandomColor());
-			active.SetNextPuyoValue(1, 0, RandomColor());
-			active.SetNextPuyoValue(1, 1, RandomColor());
-		}
-		else
-		{
-			active.SetNextPuyoValue(0, 0, active.GetNextPuyoValue(1, 0));
-			active.SetNextPuyoValue(0, 1, active.GetNextPuyoValue(1, 1));
-			active.SetNextPuyoValue(1, 0, active.GetNextPuyoValue(2, 0));
-			active.SetNextPuyoValue(1, 1, active.GetNextPuyoValue(2, 1));
-		}
+		fallSpeed = 2;
+		maxGameDuration = 600;
+		standardField = false;
+		perf.visible = false;
+		animate = true;
+		bot = NULL;
+		control.SetListener(this);
+	}
 
-		active.SetNextPuyoValue(2, 0, RandomColor());
-		active.SetNextPuyoValue(2, 1, RandomColor());
+	~PuyoGame()
+	{
+		delete bot;
+		endwin();
 	}
 
-public:
-	// 着地判定
-	bool LandingPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	void Run()
 	{
-		bool landed = false;
-		int ly, lx = 0;
-		for (int y = stack.GetLine() - 1; y >= 0; y--)
-		{
-			for (int x = 0; x < active.GetColumn(); x++)
-			{
-				if (active.GetValue(y, x) != NONE && (y == active.GetLine() - 1 || stack.GetValue(y + 1, x) != NONE))
-				{
-					stack.SetValue(y, x, active.GetValue(y, x));
-					active.SetValue(y, x, NONE);
-					ly = y;
-					lx = x;
-				}
-			}
-		}
+		InitScreen();
 
-		if (active.CountPuyo() == 1)
+		// Open the scoreboard, carrying over the scores of the old text format the first time
+		bool existed = access("scoreboard.dat", F_OK) == 0 || access("scoreboard.log", F_OK) == 0;
+		if (scoreboard.Open("scoreboard") && !existed && scoreboard.Import("scoreboard.txt") > 0)
 		{
-			for (int x = lx - 1; x <= lx + 1; x++)
-			{
-				if (x < 0 || x > active.GetColumn() - 1)
-				{
-					continue;
-				}
-				if (active.GetValue(ly, x) != NONE)
-				{
-					stack.SetValue(ly, x, active.GetValue(ly, x));
-					active.SetValue(ly, x, NONE);
-				}
-			}
-			LandFloating(active, stack);
+			scoreboard.Refresh();
 		}
+		scoreboard.CompactInBackground(COMPACT_THRESHOLD);
 
-		if (active.CountPuyo() == 0)
+		bool end = false;
+		while (!end)
 		{
-			landed = true;
-			if (GetChainCount() == 0)
+			int choice = ShowMainMenu();
+			switch (choice)
 			{
-				ClearScoreDisplay();
+			case 1:
+				// Start game
+				RunGame(false);
+				break;
+			case 2:
+				// Watch the AI play
+				RunGame(true);
+				break;
+			case 3:
+				// check Scoreboard
+				ShowScoreboard();
+				break;
+			case 4:
+				// Settings
+				ShowSettingMenu();
+				break;
+			case 5:
+				// exit game
+				end = true;
+				break;
+			default:
+				break;
 			}
 		}
-		return landed;
+		// exit game
+		endwin();
 	}
 
-	// 浮いた着地済みぷよを落下中ぷよに変換
-	bool StackFloating(PuyoArrayActive &active, PuyoArrayStack &stack)
+	// Play games with scripted input on the current (usually null) screen, through the same
+	// loop body as RunGame: generation, moves, landing, chains, scoring, recording and drawing
+	// Each game uses its own fixed seed; returns the sum of the scores so runs can be compared
+	long long RunWorkload(int games, int pieces, uint64_t seed, unsigned int line, unsigned int column)
 	{
-		bool floating = false;
-		for (int y = stack.GetLine() - 2; y >= 0; y--)
+		animate = false;
+		PuyoRandom script(seed);
+		long long total = 0;
+		for (int game = 0; game < games; game++)
 		{
-			for (int x = 0; x < stack.GetColumn(); x++)
+			gameStartTime = std::time(NULL);
+			active.ChangeSize(line, column);
+			stack.ChangeSize(line, column);
+			control.SetSpawnColumn(PuyoControl::SpawnColumnFor(column));
+			control.SetSeed(PuyoMix64(seed + game));
+			control.SetMaxChain(0);
+			control.ResetGame(active, stack);
+			clear();
+			DisplayStatic();
+			replay.Begin(control, stack, FallInterval(), static_cast<long long>(gameStartTime));
+			ResetPerf();
+
+			// Pick a random placement for every pair and press the keys that lead there,
+			// with a gravity step every few keys as a player would see
+			PuyoPlacement target = PuyoPlacement();
+			bool planned = false;
+			int placed = 0;
+			unsigned int time = 0;
+			for (int keys = 1; placed < pieces && !IsGameOver(); keys++)
 			{
-				if (stack.GetValue(y, x) != NONE && stack.GetValue(y + 1, x) == NONE)
+				int ch = ERR;
+				if (control.CanMove(active, stack))
 				{
-					active.SetValue(y, x, stack.GetValue(y, x));
-					stack.SetValue(y, x, NONE);
-					floating = true;
+					if (!planned)
+					{
+						target.column = script.Below(column);
+						target.rotation = script.Below(4);
+						planned = true;
+					}
+					ch = KeyTowards(target);
 				}
+				if (Advance(KeyToInput(ch), keys % WORKLOAD_GRAVITY_KEYS == 0, time, -1))
+				{
+					planned = false;
+					placed++;
+				}
+				Render();
+				time += WORKLOAD_KEY_INTERVAL;
 			}
+			replay.End(control, stack);
+			total += stack.GetScore();
 		}
-		return floating;
+		animate = true;
+		return total;
 	}
 
-	// 浮いた着地済みぷよの着地処理
-	bool LandFloating(PuyoArrayActive &active, PuyoArrayStack &stack)
+	// Play a recorded game back on screen at its original speed
+	// seekSeconds jumps into the middle of the game using the nearest keyframe
+	void RunReplay(const PuyoReplay &playback, int seekSeconds)
 	{
-		if (StackFloating(active, stack))
+		InitScreen();
+		gameStartTime = std::time(NULL) - seekSeconds;
+
+		// Fast-forward silently; the animations would only slow the seek down
+		control.SetListener(NULL);
+		unsigned int seekTime = static_cast<unsigned int>(seekSeconds) * 1000;
+		size_t index = playback.Seek(control, active, stack, seekTime);
+		control.SetListener(this);
+
+		timeline.Clear();
+		clear();
+		DisplayStatic();
+		Display();
+
+		const std::vector<PuyoReplayEvent> &events = playback.GetEvents();
+		long long playStart = NowMilliseconds() - seekTime;
+		while (index < events.size())
 		{
-			while (LandingPuyo(active, stack) != true)
+			// Wake up for the next event, or earlier for the next animation frame
+			long long eventTime = playStart + events[index].time;
+			long long deadline = eventTime;
+			if (!timeline.IsEmpty())
 			{
-				MoveDown(active, stack);
-				_Display(active, stack);
-				usleep(150000);
+				deadline = std::min(deadline, timeline.GetNextFrameTime(NowMilliseconds()));
 			}
-			return true;
+			int ch = WaitInput(deadline);
+			if (ch == 'Q')
+			{
+				break;
+			}
+			if (ch != ERR)
+			{
+				continue;
+			}
+			if (NowMilliseconds() >= eventTime)
+			{
+				playback.Apply(control, active, stack, index);
+				index++;
+			}
+			Display();
 		}
-		else
+
+		mvprintw(LINES - 1, 0, "Replay finished, score %d (recorded %d). Press 'q' to exit", stack.GetScore(), playback.GetFinalScore());
+		refresh();
+		while (getch() != 'q')
 		{
-			return false;
 		}
+		endwin();
 	}
 
-	// 左移動
-	void MoveLeft(PuyoArrayActive &active, PuyoArrayStack &stack)
+	// Time Display() over a corpus of fields on the current (usually null) screen
+	// Consecutive frames show different fields, so every frame redraws the whole field
+	void BenchmarkDisplay(PuyoBenchmark &bench, const std::vector<PuyoBenchField> &corpus)
 	{
-		for (int y = 0; y < active.GetLine() - 1; y++)
-		{
-			for (int x = 1; x < active.GetColumn(); x++)
-			{
-				if (active.GetValue(y, x) == NONE)
-				{
-					continue;
-				}
-				// 垂直に並んだ2つのぷよの下の1つ移動できなければ2つとも移動できない
-				if (active.GetValue(y + 1, x) != NONE && stack.GetValue(y + 1, x - 1) != NONE)
-				{
-					return;
-				}
-				// 移動先の位置では落下中のぷよや着地済みぷよがなければ移動
-				if (active.GetValue(y, x - 1) == NONE && stack.GetValue(y, x - 1) == NONE)
-				{
-					active.SetValue(y, x - 1, active.GetValue(y, x));
-					active.SetValue(y, x, NONE);
-				}
-			}
-		}
+		gameStartTime = std::time(NULL);
+		clear();
+		DisplayStatic();
+		bench.Measure("Display", corpus, [&](PuyoBenchField &field) {
+			active = field.active;
+			stack = field.stack;
+			Display();
+		});
 	}
 
-	// 右移動
-	void MoveRight(PuyoArrayActive &active, PuyoArrayStack &stack)
+private:
+	// Last HUD values drawn, so unchanged fields are not formatted again
+	struct HudState
 	{
-		for (int y = 0; y < active.GetLine() - 1; y++)
-		{
-			for (int x = active.GetColumn() - 2; x >= 0; x--)
-			{
-				if (active.GetValue(y, x) == NONE)
-				{
-					continue;
-				}
-				// 垂直に並んだ2つのぷよの下の1つ移動できなければ2つとも移動できない
-				if (active.GetValue(y + 1, x) != NONE && stack.GetValue(y + 1, x + 1) != NONE)
-				{
-					return;
-				}
-				// 移動先の位置では落下中のぷよや着地済みぷよがなければ移動
-				if (active.GetValue(y, x + 1) == NONE && stack.GetValue(y, x + 1) == NONE)
-				{
-					active.SetValue(y, x + 1, active.GetValue(y, x));
-					active.SetValue(y, x, NONE);
-				}
-			}
-		}
-	}
+		int count;
+		int score;
+		bool highScore;
+		int maxChain;
+		int gameDuration;
+	};
 
-	// 下移動
-	void MoveDown(PuyoArrayActive &active, PuyoArrayStack &stack)
+	PuyoArrayActive active;
+	PuyoArrayStack stack;
+	PuyoControl control;
+	PuyoRenderer renderer;
+	HudState hud;
+	// Performance overlay ('p'): loop rate and where the time of each iteration goes
+	struct PerfState
+	{
+		bool visible;
+		// Update() plus recording
+		PuyoHistogram tick;
+		// Display(), which ends with refresh()
+		PuyoHistogram render;
+		// From a key arriving to the frame that shows its effect
+		PuyoHistogram latency;
+		// Loop iterations in each full second
+		PuyoHistogram loops;
+		long long windowStart;
+		int windowLoops;
+		// Oldest key whose effect is not drawn yet (NowMicroseconds()), or negative
+		long long pendingInput;
+	};
+	PerfState perf;
+	// Shortest time between two frames (about 60 a second), however fast keys and gravity steps come
+	static const int RENDER_INTERVAL = 16;
+	// Milliseconds between two keys pressed by the AI
+	static const int BOT_MOVE_INTERVAL = 50;
+	// Milliseconds between two checks of the time limit while the game is paused
+	static const int PAUSE_CHECK_INTERVAL = 1000;
+	// Scripted input of --train-workload: a key every 16 ms, gravity every 8 keys
+	static const int WORKLOAD_KEY_INTERVAL = 16;
+	static const int WORKLOAD_GRAVITY_KEYS = 8;
+	// Queue chain animations (off when nobody watches)
+	bool animate;
+	// Chain animations still to be shown, and the field their frames are unpacked into
+	PuyoTimeline timeline;
+	PuyoArrayStack animationStack;
+	// Blinking of vanished puyos: off, on, off
+	static const int BLINK_FRAMES = 3;
+	static const int BLINK_FRAME_TIME = 300;
+	// Milliseconds for a floating puyo to drop one row
+	static const int FALL_FRAME_TIME = 150;
+	// Milliseconds the emptied field is held with "ALL CLEAR!" before the game goes on
+	static const int ALL_CLEAR_TIME = 500;
+	// Created by the first game the AI plays; it starts worker threads and a transposition table
+	PuyoBot *bot;
+	PuyoPlacement botTarget;
+	bool botPlanned;
+	// The game being recorded
+	PuyoReplay replay;
+	// Scores saved by every puyo8 process on this host
+	PuyoScoreStore scoreboard;
+	// Unmerged log records that trigger a background compaction
+	static const size_t COMPACT_THRESHOLD = 64;
+	std::time_t gameStartTime;
+	// Gravity in rows per second (Speed setting)
+	int fallSpeed;
+	int maxGameDuration;
+	// Play on the standard 6 x 13 field instead of one sized to the terminal
+	bool standardField;
+
+	int ShowMainMenu()
 	{
-		for (int y = active.GetLine() - 2; y >= 0; y--)
+		clear();
+
+		int choice = 0;
+		int highlight = 0;
+		int ch;
+
+		attron(COLOR_PAIR(RED));
+		mvprintw(LINES / 2 - 3, COLS / 2 - 4, "P");
+		attroff(COLOR_PAIR(RED));
+
+		attron(COLOR_PAIR(YELLOW));
+		mvprintw(LINES / 2 - 3, COLS / 2 - 3, "u");
+		attroff(COLOR_PAIR(YELLOW));
+
+		attron(COLOR_PAIR(GREEN));
+		mvprintw(LINES / 2 - 3, COLS / 2 - 2, "y");
+		attroff(COLOR_PAIR(GREEN));
+
+		attron(COLOR_PAIR(BLUE));
+		mvprintw(LINES / 2 - 3, COLS / 2 - 1, "o");
+		attroff(COLOR_PAIR(BLUE));
+
+		attron(COLOR_PAIR(RED));
+		mvprintw(LINES / 2 - 3, COLS / 2, " P");
+		attroff(COLOR_PAIR(RED));
+
+		attron(COLOR_PAIR(YELLOW));
+		mvprintw(LINES / 2 - 3, COLS / 2 + 2, "u");
+		attroff(COLOR_PAIR(YELLOW));
+
+		attron(COLOR_PAIR(GREEN));
+		mvprintw(LINES / 2 - 3, COLS / 2 + 3, "y");
+		attroff(COLOR_PAIR(GREEN));
+
+		attron(COLOR_PAIR(BLUE));
+		mvprintw(LINES / 2 - 3, COLS / 2 + 4, "o");
+		attroff(COLOR_PAIR(BLUE));
+
+		mvprintw(LINES - 1, 0, "Press Up Down Enter or Number Key to Choose");
+
+		while (1)
 		{
-			for (int x = 0; x < active.GetColumn(); x++)
+
+			// Display main menu options
+			mvprintw(LINES / 2 - 1, COLS / 2 - 6, "1. Start     ");
+			mvprintw(LINES / 2, COLS / 2 - 6, "2. AI Play   ");
+			mvprintw(LINES / 2 + 1, COLS / 2 - 6, "3. Scoreboard");
+			mvprintw(LINES / 2 + 2, COLS / 2 - 6, "4. Settings  ");
+			mvprintw(LINES / 2 + 3, COLS / 2 - 6, "5. Quit      ");
+
+			// Highlight the current option
+			mvchgat(LINES / 2 + highlight - 1, COLS / 2 - 6, 13, A_REVERSE, 0, NULL);
+
+			ch = getch();
+
+			switch (ch)
 			{
-				if (active.GetValue(y, x) == NONE)
+			case '1':
+				choice = 1;
+				break;
+			case '2':
+				choice = 2;
+				break;
+			case '3':
+				choice = 3;
+				break;
+			case '4':
+				choice = 4;
+				break;
+			case '5':
+				choice = 5;
+				break;
+			case KEY_UP:
+				if (highlight > 0)
 				{
-					continue;
+					highlight--;
 				}
-				if (active.GetValue(y + 1, x) == NONE && stack.GetValue(y + 1, x) == NONE)
+				break;
+			case KEY_DOWN:
+				if (highlight < 4)
 				{
-					active.SetValue(y + 1, x, active.GetValue(y, x));
-					active.SetValue(y, x, NONE);
+					highlight++;
 				}
+				break;
+			case '\n':
+				choice = highlight + 1;
+				break;
+			default:
+				break;
 			}
-		}
-	}
-
-	// ぷよ消滅処理を全座標で行う
-	// 消滅したぷよの数を返す
-	// 得点計算を行う
-	int VanishPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		int vanishednumber = 0;
-		int vanishnum = 0;
-		int colorCount = 0;
-		int connectionBonusValue = 0;
-		int colorBonusValue = 0;
-		int chainBonusValue = 0;
-		int totalBonus = 0;
-		int score = 0;
-		puyocolor color;
-		std::vector<puyocolor> vanishedColors;
-
-		int chainBonus[] = {0, 8, 16, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 480, 512};
-		int connectionBonus[] = {0, 2, 3, 4, 5, 6, 7, 10};
-		int colorBonus[] = {0, 3, 6, 12, 24};
 
-		for (int y = 0; y < stack.GetLine(); y++)
-		{
-			for (int x = 0; x < stack.GetColumn(); x++)
+			if (choice != 0)
 			{
-				color = stack.GetValue(y, x);
-				vanishnum = VanishPuyo(active, stack, y, x);
-
-				if (vanishnum > 0)
-				{
-					// 連結ボーナス計算
-					if (vanishnum > 11)
-					{
-						connectionBonusValue += connectionBonus[sizeof(connectionBonus) / sizeof(connectionBonus[0]) - 1];
-					}
-					else
-					{
-						connectionBonusValue += connectionBonus[vanishnum - 4];
-					}
-					vanishednumber += vanishnum;
-					vanishedColors.push_back(color);
-				}
+				break;
 			}
 		}
+		clear();
+		return choice;
+	}
 
-		if (vanishednumber == 0)
-		{
-			return 0;
-		}
-		// 色数ボーナスの計算
-		std::set<puyocolor> uniqueColors(vanishedColors.begin(), vanishedColors.end());
-		colorCount = uniqueColors.size();
-		colorBonusValue = colorBonus[colorCount - 1];
-		// 連鎖ボーナスの計算
-		chainBonusValue = chainBonus[GetChainCount()];
-		AddChainCount(1);
-		// 得点計算
-		totalBonus = chainBonusValue + connectionBonusValue + colorBonusValue;
-		if (totalBonus == 0)
-		{
-			totalBonus = 1;
-		}
-		score = vanishednumber * totalBonus * 10;
-		stack.AddScore(score);
-		stack.SetNowScore(score);
-		_ScoreDisplay(active, stack);
-
-		return vanishednumber;
+	void InitScreen()
+	{
+		// 画面の初期化
+		initscr();
+		// カラー属性を扱うための初期化
+		start_color();
+		PuyoRenderer::Init();
+		// キーを押しても画面に表示しない
+		noecho();
+		// キー入力を即座に受け付ける
+		cbreak();
+		curs_set(0);
+		// キー入力受付方法指定
+		keypad(stdscr, TRUE);
+		// キー入力ブロッキングモード (メニューは入力があるまで待つ)
+		timeout(-1);
 	}
 
-	// ぷよ消滅処理を座標(x,y)で行う
-	// 消滅したぷよの数を返す
-	int VanishPuyo(PuyoArrayActive &active, PuyoArrayStack &stack, unsigned int y, unsigned int x)
+	void RunGame(bool botPlay)
 	{
-		// 判定個所にぷよがなければ処理終了
-		if (stack.GetValue(y, x) == NONE)
+		clear();
+		// Record the timestamp of the start of the game
+		gameStartTime = std::time(NULL);
+		// Initializing the game
+		if (standardField)
 		{
-			return 0;
+			active.ChangeSize(PuyoStandardField::LINE_NUMBER, PuyoStandardField::COLUMN_NUMBER);
+			stack.ChangeSize(PuyoStandardField::LINE_NUMBER, PuyoStandardField::COLUMN_NUMBER);
 		}
-
-		// 判定状態を表す列挙型
-		// NOCHECK判定未実施，CHECKINGが判定対象，CHECKEDが判定済み
-		enum checkstate
-		{
-			NOCHECK,
-			CHECKING,
-			CHECKED
-		};
-
-		// 判定結果格納用の配列
-		enum checkstate *field_array_check;
-		field_array_check = new enum checkstate[stack.GetLine() * stack.GetColumn()];
-
-		// 配列初期化
-		for (int i = 0; i < stack.GetLine() * stack.GetColumn(); i++)
+		else
 		{
-			field_array_check[i] = NOCHECK;
+			active.ChangeSize(LINES / 2, COLS / 2);
+			stack.ChangeSize(LINES / 2, COLS / 2);
 		}
+		control.SetSpawnColumn(PuyoControl::SpawnColumnFor(stack.GetColumn()));
+		// A fresh seed per game; the replay stores it with every generated color
+		control.SetSeed(PuyoMix64(std::time(NULL)) ^ NowMilliseconds());
+		control.ResetGame(active, stack);
+		DisplayStatic();
 
-		// 座標(x,y)を判定対象にする
-		field_array_check[y * stack.GetColumn() + x] = CHECKING;
-		puyocolor color = stack.GetValue(y, x);
-		// 判定対象が1つもなくなるまで，判定対象の上下左右に同じ色のぷよがあるか確認し，あれば新たな判定対象にする
-		bool checkagain = true;
-		while (checkagain)
+		if (botPlay)
 		{
-			checkagain = false;
-
-			for (int yy = 0; yy < stack.GetLine(); yy++)
+			if (bot == NULL)
 			{
-				for (int xx = 0; xx < stack.GetColumn(); xx++)
-				{
-					//(xx,yy)に判定対象がある場合
-					if (field_array_check[yy * stack.GetColumn() + xx] == CHECKING)
-					{
-						//(xx+1,yy)の判定
-						if (xx < stack.GetColumn() - 1)
-						{
-							//(xx+1,yy)と(xx,yy)のぷよの色が同じで，(xx+1,yy)のぷよが判定未実施か確認
-							if (stack.GetValue(yy, xx + 1) == stack.GetValue(yy, xx) && field_array_check[yy * stack.GetColumn() + (xx + 1)] == NOCHECK)
-							{
-								//(xx+1,yy)を判定対象にする
-								field_array_check[yy * stack.GetColumn() + (xx + 1)] = CHECKING;
-								checkagain = true;
-							}
-						}
-
-						//(xx-1,yy)の判定
-						if (xx > 0)
-						{
-							if (stack.GetValue(yy, xx - 1) == stack.GetValue(yy, xx) && field_array_check[yy * stack.GetColumn() + (xx - 1)] == NOCHECK)
-							{
-								field_array_check[yy * stack.GetColumn() + (xx - 1)] = CHECKING;
-								checkagain = true;
-							}
-						}
-
-						//(xx,yy+1)の判定
-						if (yy < stack.GetLine() - 1)
-						{
-							if (stack.GetValue(yy + 1, xx) == stack.GetValue(yy, xx) && field_array_check[(yy + 1) * stack.GetColumn() + xx] == NOCHECK)
-							{
-								field_array_check[(yy + 1) * stack.GetColumn() + xx] = CHECKING;
-								checkagain = true;
-							}
-						}
-
-						//(xx,yy-1)の判定
-						if (yy > 0)
-						{
-							if (stack.GetValue(yy - 1, xx) == stack.GetValue(yy, xx) && field_array_check[(yy - 1) * stack.GetColumn() + xx] == NOCHECK)
-							{
-								field_array_check[(yy - 1) * stack.GetColumn() + xx] = CHECKING;
-								checkagain = true;
-							}
-						}
-
-						//(xx,yy)を判定済みにする
-						field_array_check[yy * stack.GetColumn() + xx] = CHECKED;
-					}
-				}
+				bot = new PuyoBot();
 			}
+			// Keep the search well inside one fall interval on large fields
+			bot->SetBeamWidth(std::max(4, std::min(64, 6000 / (int)(stack.GetLine() * stack.GetColumn()))));
+			bot->SetColorNum(control.GetColorNum());
+			bot->SetSpawnColumn(control.GetSpawnColumn());
 		}
+		botPlanned = false;
 
-		// 判定済みの数をカウント
-		int puyocount = 0;
-		for (int i = 0; i < stack.GetLine() * stack.GetColumn(); i++)
-		{
-			if (field_array_check[i] == CHECKED)
+		// Start the game
+		bool isPaused = false;
+		long long pauseStart = 0;
+		// Gravity steps come at fixed times from the start of the game, so the fall speed
+		// does not depend on how long the loop or the drawing takes
+		int fallInterval = FallInterval();
+		long long nextFall = NowMilliseconds();
+		long long nextBotMove = nextFall;
+		long long replayStart = nextFall;
+		// Frames are drawn separately from the rules, at most one per RENDER_INTERVAL
+		bool dirty = false;
+		long long nextRender = nextFall;
+		timeline.Clear();
+		replay.Begin(control, stack, fallInterval, static_cast<long long>(gameStartTime));
+		ResetPerf();
+
+		// The last chain is shown to the end even when it fills the spawn position
+		while (!timeline.IsEmpty() || !IsGameOver())
+		{
+			if (dirty && NowMilliseconds() >= nextRender)
 			{
-				puyocount++;
+				Render();
+				dirty = false;
+				nextRender = NowMilliseconds() + RENDER_INTERVAL;
 			}
-		}
 
-		// 4個以上あれば，判定済み座標のぷよを消す
-		int vanishednumber = 0;
-		if (4 <= puyocount)
-		{
-			for (int i = 0; i <= 2; i++)
+			// Sleep until a key arrives or the next gravity step (or animation frame, or frame to draw) is due
+			long long deadline = botPlay ? std::min(nextFall, nextBotMove) : nextFall;
+			if (!timeline.IsEmpty())
 			{
-				vanishednumber = 0;
-				// i の奇偶によってパターンを切り替える
-				bool isVanished = (i % 2 == 0);
-				// puyostack内の対応する位置の値を更新
-				for (int yy = 0; yy < stack.GetLine(); yy++)
-				{
-					for (int xx = 0; xx < stack.GetColumn(); xx++)
-					{
-						if (field_array_check[yy * stack.GetColumn() + xx] == CHECKED)
-						{
-							if (isVanished)
-							{
-								stack.SetValue(yy, xx, NONE);
-								vanishednumber++;
-							}
-							else
-							{
-								stack.SetValue(yy, xx, color);
-							}
-						}
-					}
-				}
-				_Display(active, stack);
-				usleep(300000);
+				deadline = timeline.GetNextFrameTime(NowMilliseconds());
 			}
-		}
-
-		// メモリ解放
-		delete[] field_array_check;
-
-		return vanishednumber;
-	}
-
-	void Rotate(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		for (int y = 0; y < active.GetLine() - 1; y++)
-		{
-			for (int x = 0; x < active.GetColumn(); x++)
+			// While paused, still wake up now and then so the time limit can end the game
+			if (isPaused)
+			{
+				deadline = NowMilliseconds() + PAUSE_CHECK_INTERVAL;
+			}
+			if (dirty)
+			{
+				deadline = std::min(deadline, nextRender);
+			}
+			int ch = WaitInput(deadline);
+			long long inputTime = (ch != ERR) ? NowMicroseconds() : -1;
+			CountPerfLoop(inputTime >= 0 ? inputTime : NowMicroseconds());
+			// pの入力で性能表示の切り替え
+			if (ch == 'p')
+			{
+				perf.visible = !perf.visible;
+				DrawPerf();
+				refresh();
+				continue;
+			}
+			if (botPlay && ch != 's' && ch != 'Q')
 			{
-				if (active.GetValue(y, x) != NONE)
+				// The AI presses the keys itself; players can only pause or quit
+				ch = ERR;
+				if (NowMilliseconds() >= nextBotMove)
 				{
-					switch (active.GetPuyoRotate())
-					{
-					case 0:
-						if (y == active.GetLine() - 1 || (stack.GetValue(y + 1, x) != NONE || stack.GetValue(y + 1, x + 1) != NONE))
-						{
-							return;
-						}
-						active.SetValue(y + 1, x, active.GetValue(y, x + 1));
-						active.SetValue(y, x + 1, NONE);
-						active.SetPuyoRate(1);
-						return;
-					case 1:
-						if (x == 0 || (stack.GetValue(y, x - 1) != NONE || stack.GetValue(y + 1, x - 1) != NONE))
-						{
-							return;
-						}
-						active.SetValue(y, x - 1, active.GetValue(y + 1, x));
-						active.SetValue(y + 1, x, NONE);
-						active.SetPuyoRate(2);
-						return;
-					case 2:
-						if (y == 0 || (stack.GetValue(y - 1, x + 1) != NONE || stack.GetValue(y - 1, x) != NONE))
-						{
-							return;
-						}
-						active.SetValue(y - 1, x + 1, active.GetValue(y, x));
-						active.SetValue(y, x, NONE);
-						active.SetPuyoRate(3);
-						return;
-					case 3:
-						if (x == active.GetColumn() - 1 || (stack.GetValue(y + 1, x + 1) != NONE || stack.GetValue(y, x + 1) != NONE))
-						{
-							return;
-						}
-						active.SetValue(y + 1, x + 1, active.GetValue(y, x));
-						active.SetValue(y, x, NONE);
-						active.SetPuyoRate(0);
-						return;
-					default:
-						active.SetPuyoRate(0);
-						return;
-					}
+					ch = BotKey();
+					nextBotMove = NowMilliseconds() + BOT_MOVE_INTERVAL;
 				}
 			}
-		}
-		return;
-	}
-
-	void ResetGame(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		for (int y = 0; y < active.GetLine(); y++)
-		{
-			for (int x = 0; x < active.GetColumn(); x++)
+			// sの入力で一時停止
+			if (ch == 's')
 			{
-				if (active.GetValue(y, x) != NONE)
+				isPaused = !isPaused;
+				// The animation stands still while paused
+				if (isPaused)
 				{
-
-					active.SetValue(y, x, NONE);
+					pauseStart = NowMilliseconds();
 				}
-				if (stack.GetValue(y, x) != NONE)
+				else
 				{
-
-					stack.SetValue(y, x, NONE);
+					timeline.Delay(NowMilliseconds() - pauseStart);
 				}
+				nextFall = NowMilliseconds() + fallInterval;
+				replay.Record(control, active, stack, NowMilliseconds() - replayStart, REPLAY_PAUSE, INPUT_NONE, false);
+			}
+			if (isPaused)
+			{
+				continue;
 			}
-		}
-		stack.SetNowScore(0);
-		stack.SetScore(0);
-	}
-
-	// 落下中ぷよは操作可能か判定
-	bool CanMove(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		if (active.GetValue(0, 5) != NONE && active.GetValue(0, 6) != NONE)
-		{
-			return false;
-		}
-
-		if (active.CountPuyo() == 2)
-		{
-			return true;
-		}
 
-		return false;
-	}
+			// Qの入力で終了
+			if (ch == 'Q')
+			{
+				replay.Record(control, active, stack, NowMilliseconds() - replayStart, REPLAY_QUIT, INPUT_NONE, false);
+				break;
+			}
 
-private:
-	void _Display(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		// 文字の色と背景の色のペアを初期化する
-		init_pair(0, COLOR_WHITE, COLOR_BLACK);
-		init_pair(1, COLOR_RED, COLOR_BLACK);
-		init_pair(2, COLOR_BLUE, COLOR_BLACK);
-		init_pair(3, COLOR_GREEN, COLOR_BLACK);
-		init_pair(4, COLOR_YELLOW, COLOR_BLACK);
-		init_pair(5, COLOR_MAGENTA, COLOR_BLACK);
+			// 連鎖のアニメーション中は表示だけ進めてルールと落下の時計は止めておく
+			if (!timeline.IsEmpty())
+			{
+				nextFall = NowMilliseconds() + fallInterval;
+				dirty = true;
+				continue;
+			}
 
-		// ぷよ表示
-		for (int y = 0; y < active.GetLine(); y++)
-		{
-			for (int x = 0; x < active.GetColumn(); x++)
+			// 落下タイミングになったら1段落とす
+			// 次の落下は前回の予定時刻から数える (1段分以上遅れたときはまとめて落とさず今から数え直す)
+			long long now = NowMilliseconds();
+			bool gravity = now >= nextFall;
+			if (gravity)
 			{
-				if (active.GetValue(y, x) != NONE)
+				nextFall += fallInterval;
+				if (nextFall <= now)
 				{
-					switch (active.GetValue(y, x))
-					{
-					case RED:
-						attrset(COLOR_PAIR(1));
-						mvaddch(y, x, 'R');
-						break;
-					case BLUE:
-						attrset(COLOR_PAIR(2));
-						mvaddch(y, x, 'B');
-						break;
-					case GREEN:
-						attrset(COLOR_PAIR(3));
-						mvaddch(y, x, 'G');
-						break;
-					case YELLOW:
-						attrset(COLOR_PAIR(4));
-						mvaddch(y, x, 'Y');
-						break;
-					case PURPLE:
-						attrset(COLOR_PAIR(5));
-						mvaddch(y, x, 'P');
-						break;
-					default:
-						break;
-					}
-				}
-				else
-				{
-					switch (stack.GetValue(y, x))
-					{
-					case NONE:
-						attrset(COLOR_PAIR(0));
-						mvaddch(y, x, '.');
-						break;
-					case RED:
-						attrset(COLOR_PAIR(1));
-						mvaddch(y, x, 'R');
-						break;
-					case BLUE:
-						attrset(COLOR_PAIR(2));
-						mvaddch(y, x, 'B');
-						break;
-					case GREEN:
-						attrset(COLOR_PAIR(3));
-						mvaddch(y, x, 'G');
-						break;
-					case YELLOW:
-						attrset(COLOR_PAIR(4));
-						mvaddch(y, x, 'Y');
-						break;
-					case PURPLE:
-						attrset(COLOR_PAIR(5));
-						mvaddch(y, x, 'P');
-						break;
-					default:
-						mvaddch(y, x, '?');
-						break;
-					}
+					nextFall = now + fallInterval;
 				}
 			}
+			Advance(KeyToInput(ch), gravity, now - replayStart, inputTime);
+			dirty = true;
 		}
 
-		refresh();
-	}
+		replay.End(control, stack);
+		std::string replayFile = SaveReplay();
+		SavePerf();
 
-	void _ScoreDisplay(PuyoArrayActive &active, PuyoArrayStack &stack)
-	{
-		int addScore = stack.GetNowscore();
-		int chain = GetChainCount();
-
-		if (addScore > 0)
-		{
-			mvprintw(4, COLS - 29, "+ %d     ", addScore);
-		}
-
-		if (chain > 1)
-		{
-			mvprintw(4, COLS - 14, "Chain %d!", chain);
-		}
-
-		if (stack.CountPuyo() == 0)
-		{
-			mvprintw(LINES / 2 + 1, COLS / 2 - 10, "ALL CLEAR!");
-		}
-
-		refresh();
-	}
-
-	void ClearScoreDisplay()
-	{
-		mvprintw(4, COLS - 29, "                            ");
-		mvprintw(LINES / 2 + 1, COLS / 2 - 10, "           ");
-		refresh();
+		clear();
+		ShowGameOverScreen(replayFile);
 	}
 
-	// ランダムなぷよ色を生成
-	puyocolor RandomColor()
+	// Milliseconds between two gravity steps
+	int FallInterval() const
 	{
-		int colornumber = GetColorNum();
-
-		int randomIndex = 1 + std::rand() % colornumber;
-
-		// ランダムな整数を列挙型の値に変換する
-		puyocolor newpuyo;
-		newpuyo = static_cast<puyocolor>(randomIndex);
-		return newpuyo;
-
-		/*
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_int_distribution<> distribution(0, colornumber - 1);
-
-		int randomIndex = distribution(gen) + 1;
-		puyocolor newpuyo;
-		newpuyo = static_cast<puyocolor>(randomIndex);
-		return newpuyo;
-		*/
+		return 1000 / fallSpeed;
 	}
 
-private:
-	int ChainCount;
-	int MaxChain;
-	int ColorNum;
-
-public:
-	PuyoControl()
+	// Map a key to the engine input it stands for
+	static puyoinput KeyToInput(int ch)
 	{
-		// 連鎖数
-		ChainCount = 0;
-
-		// 最大連鎖数
-		MaxChain = 0;
-
-		// ぷよの色数
-		ColorNum = 4;
-
-		// 乱数生成器を初期化する
-		std::srand(std::time(NULL));
-	}
-
-	int GetChainCount() const
-	{
-		return ChainCount;
-	}
-	void AddChainCount(int num)
-	{
-		ChainCount += num;
-		if (ChainCount > MaxChain)
+		switch (ch)
 		{
-			SetMaxChain(ChainCount);
+		case KEY_LEFT:
+			return INPUT_LEFT;
+		case KEY_RIGHT:
+			return INPUT_RIGHT;
+		case KEY_DOWN:
+			return INPUT_DOWN;
+		case 'z':
+			// ぷよ回転処理
+			return INPUT_ROTATE;
+		default:
+			return INPUT_NONE;
 		}
 	}
-	void SetChainCount(int num)
-	{
-		ChainCount = num;
-	}
 
-	int GetMaxChain() const
+	// Write the finished game to replays/<start time>.puyoreplay
+	// Returns the file name, or an empty string if it could not be written
+	std::string SaveReplay()
 	{
-		return MaxChain;
-	}
-	void SetMaxChain(int num)
-	{
-		MaxChain = num;
-	}
-
-	int GetColorNum() const
-	{
-		return ColorNum;
-	}
-	void SetColorNum(int num)
-	{
-		ColorNum = num;
+		mkdir("replays", 0755);
+		char filename[64];
+		snprintf(filename, sizeof(filename), "replays/%lld.puyoreplay", static_cast<long long>(gameStartTime));
+		if (!replay.Save(filename))
+		{
+			return "";
+		}
+		return filename;
 	}
-};
 
-class PuyoGame
-{
-public:
-	PuyoGame()
+	void ResetPerf()
 	{
-		waitCount = 20000;
-		maxGameDuration = 600;
+		perf.tick.Clear();
+		perf.render.Clear();
+		perf.latency.Clear();
+		perf.loops.Clear();
+		perf.windowStart = NowMicroseconds();
+		perf.windowLoops = 0;
+		perf.pendingInput = -1;
 	}
 
-	~PuyoGame()
+	// Count one loop iteration; once a second, close the window and refresh the overlay
+	void CountPerfLoop(long long now)
 	{
-		endwin();
+		perf.windowLoops++;
+		if (now - perf.windowStart < 1000000)
+		{
+			return;
+		}
+		perf.loops.Add(perf.windowLoops);
+		perf.windowStart = now;
+		perf.windowLoops = 0;
+		if (perf.visible)
+		{
+			DrawPerf();
+		}
 	}
 
-	void Run()
+	// Draw the overlay under the game time, or blank it when hidden
+	void DrawPerf()
 	{
-		// 画面の初期化
-		initscr();
-		// カラー属性を扱うための初期化
-		start_color();
-		// キーを押しても画面に表示しない
-		noecho();
-		// キー入力を即座に受け付ける
-		cbreak();
-		curs_set(0);
-		// キー入力受付方法指定
-		keypad(stdscr, TRUE);
-		// キー入力非ブロッキングモード
-		timeout(0);
-
-		// Read Scoreboard from file
-		playerInfoList = LoadPlayerInfo("scoreboard.txt");
-
-		bool end = false;
-		while (!end)
+		static const char *names[] = {"loops/s", "tick us", "render us", "input us"};
+		const PuyoHistogram *histograms[] = {&perf.loops, &perf.tick, &perf.render, &perf.latency};
+		char msg[64];
+		for (int i = 0; i < 5; i++)
 		{
-			int choice = ShowMainMenu();
-			switch (choice)
+			if (!perf.visible)
 			{
-			case 1:
-				// Start game
-				RunGame();
-				break;
-			case 2:
-				// check Scoreboard
-				ShowScoreboard();
-				break;
-			case 3:
-				// Settings
-				ShowSettingMenu();
-				break;
-			case 4:
-				// exit game
-				end = true;
-				break;
-			default:
-				break;
+				snprintf(msg, sizeof(msg), "%-40s", "");
+			}
+			else if (i == 0)
+			{
+				snprintf(msg, sizeof(msg), "%-10s %9s %9s %9s", "", "p50", "p99", "max");
 			}
+			else
+			{
+				const PuyoHistogram &histogram = *histograms[i - 1];
+				snprintf(msg, sizeof(msg), "%-10s %9llu %9llu %9llu", names[i - 1],
+						 (unsigned long long)histogram.Percentile(0.5), (unsigned long long)histogram.Percentile(0.99), (unsigned long long)histogram.GetMax());
+			}
+			renderer.DrawText(LINES / 2 + 3 + i, 2, 0, msg);
 		}
-		// exit game
-		endwin();
 	}
 
-private:
-	struct PlayerInfo
+	// Write the histograms of the finished game to perf/<start time>.txt
+	void SavePerf()
 	{
-		std::string name;
-		int score;
-
-		// Define a comparison function for sorting by score in descending order
-		bool operator<(const PlayerInfo &other) const
+		mkdir("perf", 0755);
+		char filename[64];
+		snprintf(filename, sizeof(filename), "perf/%lld.txt", static_cast<long long>(gameStartTime));
+		FILE *file = fopen(filename, "w");
+		if (file == NULL)
 		{
-			return score > other.score;
+			return;
 		}
-	};
-
-	PuyoArrayActive active;
-	PuyoArrayStack stack;
-	PuyoControl control;
-	std::vector<PlayerInfo> playerInfoList;
-	std::time_t gameStartTime;
-	int waitCount;
-	int maxGameDuration;
+		static const char *names[] = {"loops/s", "tick us", "render us", "input us"};
+		const PuyoHistogram *histograms[] = {&perf.loops, &perf.tick, &perf.render, &perf.latency};
+		fprintf(file, "field %u x %u, terminal %d x %d, TERM=%s\n", stack.GetLine(), stack.GetColumn(), LINES, COLS, getenv("TERM") ? getenv("TERM") : "");
+		fprintf(file, "%-10s %9s %9s %9s %9s\n", "", "count", "p50", "p99", "max");
+		for (int i = 0; i < 4; i++)
+		{
+			const PuyoHistogram &histogram = *histograms[i];
+			fprintf(file, "%-10s %9llu %9llu %9llu %9llu\n", names[i], (unsigned long long)histogram.GetCount(),
+					(unsigned long long)histogram.Percentile(0.5), (unsigned long long)histogram.Percentile(0.99), (unsigned long long)histogram.GetMax());
+		}
+		fclose(file);
+	}
 
-	std::vector<PlayerInfo> LoadPlayerInfo(const std::string &filename)
+	// One pass of the game loop once the input is known: rules and recording
+	// The screen is brought up to date by the next Render()
+	// inputTime is when a real key arrived (NowMicroseconds()), or negative
+	// Returns true when the next pair was generated
+	bool Advance(puyoinput input, bool gravity, long long replayTime, long long inputTime)
 	{
-		std::vector<PlayerInfo> playerInfoList;
-		std::ifstream file(filename.c_str());
-
-		if (!file.is_open())
+		long long tickStart = NowMicroseconds();
+		bool generated = control.Update(active, stack, input, gravity);
+		if (generated)
 		{
-			// File does not exist, create empty file
-			std::ofstream createFile(filename.c_str());
-			createFile.close();
+			botPlanned = false;
 		}
-		else
+		replay.Record(control, active, stack, replayTime, REPLAY_UPDATE, input, gravity);
+		perf.tick.Add(NowMicroseconds() - tickStart);
+		if (inputTime >= 0 && input != INPUT_NONE && perf.pendingInput < 0)
 		{
-			PlayerInfo playerInfo;
-			while (file >> playerInfo.name >> playerInfo.score)
-			{
-				playerInfoList.push_back(playerInfo);
-			}
-			file.close();
+			perf.pendingInput = inputTime;
+		}
+		return generated;
+	}
+
+	// 表示
+	// Draw everything Advance() changed since the last frame
+	void Render()
+	{
+		long long renderStart = NowMicroseconds();
+		Display();
+		long long renderEnd = NowMicroseconds();
+		perf.render.Add(renderEnd - renderStart);
+		if (perf.pendingInput >= 0)
+		{
+			perf.latency.Add(renderEnd - perf.pendingInput);
+			perf.pendingInput = -1;
 		}
-		// Sort the player info list by score in descending order
-		std::sort(playerInfoList.begin(), playerInfoList.end());
-
-		return playerInfoList;
 	}
 
-	// Save player information to file
-	void SavePlayerInfo(const std::string &filename)
+	// Next key the AI presses to bring the falling pair to its planned placement
+	int BotKey()
 	{
-		std::ofstream file(filename.c_str());
-
-		// Sort the player info list by score in descending order
-		std::sort(playerInfoList.begin(), playerInfoList.end());
-
-		if (file.is_open())
+		if (!control.CanMove(active, stack))
 		{
-			for (std::vector<PlayerInfo>::const_iterator it = playerInfoList.begin(); it != playerInfoList.end(); ++it)
+			return ERR;
+		}
+		if (!botPlanned)
+		{
+			std::vector<PuyoPair> pairs;
+			for (int i = 0; i < 3; i++)
 			{
-				const PlayerInfo &playerInfo = *it;
-				file << playerInfo.name.c_str() << " " << playerInfo.score << std::endl;
+				PuyoPair pair;
+				pair.axis = active.GetNextPuyoValue(i, 0);
+				pair.child = active.GetNextPuyoValue(i, 1);
+				pairs.push_back(pair);
 			}
-			file.close();
+			botTarget = bot->Think(stack, pairs);
+			botPlanned = true;
 		}
+		return KeyTowards(botTarget);
 	}
 
-	int ShowMainMenu()
+	// Next key that brings the falling pair closer to the target placement
+	// Follows the moves PuyoPlacer::Reach assumes: the pair travels in rotation 0 and turns
+	// where the column to its right is open too; rotations 2 and 3 turn further from
+	// rotation 1 over a column open four rows deep, then travel to the target
+	int KeyTowards(const PuyoPlacement &target)
 	{
-		clear();
-
-		int choice = 0;
-		int highlight = 0;
-		int ch;
-
-		init_pair(1, COLOR_RED, COLOR_BLACK);
-		init_pair(2, COLOR_BLUE, COLOR_BLACK);
-		init_pair(3, COLOR_YELLOW, COLOR_BLACK);
-		init_pair(4, COLOR_GREEN, COLOR_BLACK);
-
-		attron(COLOR_PAIR(1));
-		mvprintw(LINES / 2 - 3, COLS / 2 - 4, "P");
-		attroff(COLOR_PAIR(1));
-
-		attron(COLOR_PAIR(3));
-		mvprintw(LINES / 2 - 3, COLS / 2 - 3, "u");
-		attroff(COLOR_PAIR(3));
-
-		attron(COLOR_PAIR(4));
-		mvprintw(LINES / 2 - 3, COLS / 2 - 2, "y");
-		attroff(COLOR_PAIR(4));
-
-		attron(COLOR_PAIR(2));
-		mvprintw(LINES / 2 - 3, COLS / 2 - 1, "o");
-		attroff(COLOR_PAIR(2));
-
-		attron(COLOR_PAIR(1));
-		mvprintw(LINES / 2 - 3, COLS / 2, " P");
-		attroff(COLOR_PAIR(1));
-
-		attron(COLOR_PAIR(3));
-		mvprintw(LINES / 2 - 3, COLS / 2 + 2, "u");
-		attroff(COLOR_PAIR(3));
-
-		attron(COLOR_PAIR(4));
-		mvprintw(LINES / 2 - 3, COLS / 2 + 3, "y");
-		attroff(COLOR_PAIR(4));
-
-		attron(COLOR_PAIR(2));
-		mvprintw(LINES / 2 - 3, COLS / 2 + 4, "o");
-		attroff(COLOR_PAIR(2));
-
-		mvprintw(LINES - 1, 0, "Press Up Down Enter or Number Key to Choose");
-
-		while (1)
+		if (target.rotation < 0)
 		{
+			return KEY_DOWN;
+		}
 
-			// Display main menu options
-			mvprintw(LINES / 2 - 1, COLS / 2 - 6, "1. Start     ");
-			mvprintw(LINES / 2, COLS / 2 - 6, "2. Scoreboard");
-			mvprintw(LINES / 2 + 1, COLS / 2 - 6, "3. Settings  ");
-			mvprintw(LINES / 2 + 2, COLS / 2 - 6, "4. Quit      ");
-
-			// Highlight the current option
-			mvchgat(LINES / 2 + highlight - 1, COLS / 2 - 6, 13, A_REVERSE, 0, NULL);
-
-			ch = getch();
-
-			switch (ch)
+		int rotation = active.GetPuyoRotate();
+		int axis = active.GetAxisX();
+		if (rotation != target.rotation)
+		{
+			int turn = target.column;
+			if (target.rotation >= 2)
 			{
-			case '1':
-				choice = 1;
-				break;
-			case '2':
-				choice = 2;
-				break;
-			case '3':
-				choice = 3;
-				break;
-			case '4':
-				choice = 4;
-				break;
-			case KEY_UP:
-				if (highlight > 0)
+				// The column closest to the target where rotation 1 can go on turning
+				int low[4], high[4];
+				PuyoPlacer::Reach(stack, control.GetSpawnColumn(), low, high);
+				turn = -1;
+				for (int x = low[1] + 1; x <= high[1]; x++)
 				{
-					highlight--;
+					if (ColumnTop(x) > 3 && (turn < 0 || std::abs(x - target.column) < std::abs(turn - target.column)))
+					{
+						turn = x;
+					}
 				}
-				break;
-			case KEY_DOWN:
-				if (highlight < 3)
+				if (turn < 0)
 				{
-					highlight++;
+					return KEY_DOWN;
 				}
-				break;
-			case '\n':
-				choice = highlight + 1;
-				break;
-			default:
-				break;
 			}
-
-			if (choice != 0)
+			if (rotation == 0)
 			{
-				break;
+				// The child swings down over the column to the right of the axis
+				int pivot = (ColumnTop(turn + 1) > 2) ? turn : turn - 1;
+				if (axis != pivot)
+				{
+					return (axis < pivot) ? KEY_RIGHT : KEY_LEFT;
+				}
+				return 'z';
+			}
+			if (rotation == 1 && axis != turn)
+			{
+				return (axis < turn) ? KEY_RIGHT : KEY_LEFT;
 			}
+			return 'z';
 		}
-		clear();
-		return choice;
+
+		if (axis < target.column)
+		{
+			return KEY_RIGHT;
+		}
+		if (axis > target.column)
+		{
+			return KEY_LEFT;
+		}
+		return KEY_DOWN;
 	}
 
-	void RunGame()
+	// Row of the highest puyo in column x, or 0 (full) outside the field
+	int ColumnTop(int x) const
 	{
-		clear();
-		// Record the timestamp of the start of the game
-		gameStartTime = std::time(NULL);
-		// Initializing the game
-		active.ChangeSize(LINES / 2, COLS / 2);
-		stack.ChangeSize(LINES / 2, COLS / 2);
-		control.GeneratePuyo(active, stack);
-		control.ResetGame(active, stack);
+		return (x >= 0 && x < (int)stack.GetColumn()) ? (int)stack.GetTop(x) : 0;
+	}
 
-		// Start the game
-		bool isPaused = false;
-		int delay = 0;
+	// Monotonic clock in milliseconds, unaffected by wall-clock changes
+	static long long NowMilliseconds()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+
+	static long long NowMicroseconds()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
 
-		while (!IsGameOver())
+	// Block until a key is pressed or the deadline (NowMilliseconds() based) passes
+	// A negative deadline waits for input only
+	// Returns the key, or ERR if the deadline passed without input
+	int WaitInput(long long deadline)
+	{
+		while (1)
 		{
+			// Keys already buffered inside curses never show up on the fd
+			timeout(0);
 			int ch = getch();
-			// sの入力で一時停止
-			if (ch == 's')
-			{
-				isPaused = !isPaused;
-			}
-			if (isPaused)
-			{
-				continue;
-			}
-
-			// Qの入力で終了
-			if (ch == 'Q')
+			timeout(-1);
+			if (ch != ERR)
 			{
-				break;
+				return ch;
 			}
 
-			if (control.LandingPuyo(active, stack))
-			{
-				control.VanishPuyo(active, stack);
-				if (!control.LandFloating(active, stack))
-				{
-					control.GeneratePuyo(active, stack);
-				}
-			}
-			else
+			int wait = -1;
+			if (deadline >= 0)
 			{
-				if (control.CanMove(active, stack))
+				long long remaining = deadline - NowMilliseconds();
+				if (remaining <= 0)
 				{
-					// 入力キーごとの処理
-					switch (ch)
-					{
-					case KEY_LEFT:
-						control.MoveLeft(active, stack);
-						break;
-					case KEY_RIGHT:
-						control.MoveRight(active, stack);
-						break;
-					case KEY_DOWN:
-						control.MoveDown(active, stack);
-						break;
-					case 'z':
-						// ぷよ回転処理
-						control.Rotate(active, stack);
-						break;
-					default:
-						break;
-					}
+					return ERR;
 				}
+				wait = static_cast<int>(remaining);
 			}
-			// 処理速度調整のためのif文
-			if (delay % waitCount == 0)
+
+			struct pollfd fd;
+			fd.fd = STDIN_FILENO;
+			fd.events = POLLIN;
+			fd.revents = 0;
+			if (poll(&fd, 1, wait) == 0)
 			{
-				// ぷよ下に移動
-				control.MoveDown(active, stack);
+				return ERR;
 			}
-			delay++;
-			// 表示
-			Display();
 		}
-
-		clear();
-		ShowGameOverScreen();
 	}
 
 	bool IsGameOver()
@@ -1223,7 +1120,7 @@ private:
 		}
 
 		// Check if the new Puyo generation location is occupied
-		if (stack.GetValue(0, 5) != NONE || stack.GetValue(0, 6) != NONE)
+		if (control.IsSpawnBlocked(stack))
 		{
 			return true;
 		}
@@ -1238,13 +1135,19 @@ private:
 		return static_cast<int>(std::difftime(currentTime, gameStartTime));
 	}
 
-	void ShowGameOverScreen()
+	void ShowGameOverScreen(const std::string &replayFile)
 	{
 		int score = stack.GetScore();
 		clear();
 		mvprintw(LINES / 2 - 5, COLS / 2 - 5, "Game Over");
 		mvchgat(LINES / 2 - 5, COLS / 2 - 7, 13, A_REVERSE, 0, NULL);
 		mvprintw(LINES / 2 - 2, COLS / 2 - 7, "Your Score: %d", score);
+		scoreboard.Refresh();
+		mvprintw(LINES / 2 - 3, COLS / 2 - 7, "Rank: %zu / %zu", scoreboard.Rank(score) + 1, scoreboard.GetCount() + 1);
+		if (!replayFile.empty())
+		{
+			mvprintw(LINES / 2 - 1, COLS / 2 - 7, "Replay: %s", replayFile.c_str());
+		}
 		mvprintw(LINES / 2, COLS / 2 - 26, "Do you want to save your score to scoreboard? (y/n): ");
 		refresh();
 
@@ -1308,12 +1211,10 @@ private:
 			curs_set(0);
 
 			// Save Plyer Info
-			PlayerInfo playerInfo;
-			playerInfo.name = playerName;
-			playerInfo.score = score;
-			playerInfoList.push_back(playerInfo);
-
-			SavePlayerInfo("scoreboard.txt");
+			// One append to the shared log; merging it into the snapshot happens off this thread
+			scoreboard.Submit(playerName, score);
+			scoreboard.Refresh();
+			scoreboard.CompactInBackground(COMPACT_THRESHOLD);
 		}
 
 		mvprintw(LINES / 2 + 5, COLS / 2 - 15, "Press 'q' to return to the main menu");
@@ -1330,51 +1231,68 @@ private:
 		}
 	}
 
+	// Scroll with the arrow keys and Page Up/Down; only the visible page is read
 	void ShowScoreboard()
 	{
-		clear();
-
-		mvprintw(3, COLS / 2 - 5, "Scoreboard");
-		mvprintw(5, COLS / 2 - 10, "Name");
-		mvprintw(5, COLS / 2 + 5, "Score");
-		mvchgat(5, COLS / 2 - 15, 30, A_REVERSE, 0, NULL);
+		scoreboard.Refresh();
+		size_t count = scoreboard.GetCount();
+		size_t pageSize = std::max(1, LINES - 8);
+		size_t top = 0;
+		std::vector<PuyoScoreEntry> page;
 
-		int row = 6;
-
-		for (std::vector<PlayerInfo>::const_iterator it = playerInfoList.begin(); it != playerInfoList.end(); ++it)
+		while (1)
 		{
-			const PlayerInfo &player = *it;
-			mvprintw(row, COLS / 2 - 10, "%s", player.name.c_str());
-			mvprintw(row, COLS / 2 + 5, "%d", player.score);
-			row++;
-			if (row >= LINES - 2)
+			clear();
+			mvprintw(3, COLS / 2 - 5, "Scoreboard");
+			mvprintw(5, COLS / 2 - 10, "Name");
+			mvprintw(5, COLS / 2 + 5, "Score");
+			mvchgat(5, COLS / 2 - 15, 30, A_REVERSE, 0, NULL);
+
+			scoreboard.GetRange(top, pageSize, page);
+			for (size_t i = 0; i < page.size(); i++)
 			{
-				break;
+				const PuyoScoreEntry &entry = page[i];
+				int row = 6 + static_cast<int>(i);
+				mvprintw(row, COLS / 2 - 16, "%zu", top + i + 1);
+				mvprintw(row, COLS / 2 - 10, "%.*s", (int)PuyoScoreboard::NAME_LENGTH, entry.name);
+				mvprintw(row, COLS / 2 + 5, "%d", entry.score);
 			}
-		}
 
-		if (row >= 7)
-		{
-			mvprintw(6, COLS / 2 - 15, "1");
-		}
-		if (row >= 8)
-		{
-			mvprintw(7, COLS / 2 - 15, "2");
-		}
-		if (row >= 9)
-		{
-			mvprintw(8, COLS / 2 - 15, "3");
-		}
+			if (count > pageSize)
+			{
+				mvprintw(LINES - 2, 0, "%zu-%zu of %zu", top + 1, std::min(count, top + pageSize), count);
+			}
+			mvprintw(LINES - 1, 0, "Press 'q' to Quit, arrows / PgUp / PgDn to scroll");
+			refresh();
 
-		mvprintw(LINES - 1, 0, "Press 'q' to Quit");
-		refresh();
-		while (1)
-		{
+			size_t last = (count > pageSize) ? count - pageSize : 0;
 			int ch = getch();
-			if (ch == 'q')
+			switch (ch)
 			{
+			case 'q':
 				clear();
 				return; // exit
+			case KEY_UP:
+				top = (top > 0) ? top - 1 : 0;
+				break;
+			case KEY_DOWN:
+				top = std::min(last, top + 1);
+				break;
+			case KEY_PPAGE:
+				top = (top > pageSize) ? top - pageSize : 0;
+				break;
+			case KEY_NPAGE:
+			case ' ':
+				top = std::min(last, top + pageSize);
+				break;
+			case KEY_HOME:
+				top = 0;
+				break;
+			case KEY_END:
+				top = last;
+				break;
+			default:
+				break;
 			}
 		}
 	}
@@ -1382,11 +1300,7 @@ private:
 	// Return the highest score of all saved player data
 	int GetTopScore()
 	{
-		if (!playerInfoList.empty())
-		{
-			return playerInfoList[0].score;
-		}
-		return 0; // Return 0 if the list is empty
+		return scoreboard.GetTopScore(); // 0 if the scoreboard is empty
 	}
 
 	void ShowSettingMenu()
@@ -1409,6 +1323,7 @@ private:
 				mvprintw(LINES / 2, COLS / 2 - 14, "1. Falling Speed of Puyo    ");
 				mvprintw(LINES / 2 + 1, COLS / 2 - 14, "2. Max Game Duration        ");
 				mvprintw(LINES / 2 + 2, COLS / 2 - 14, "3. Numbers of Color for Puyo");
+				mvprintw(LINES / 2 + 3, COLS / 2 - 14, "4. Field Size               ");
 
 				// Highlight the current option
 				mvchgat(LINES / 2 + highlight, COLS / 2 - 14, 28, A_REVERSE, 0, NULL);
@@ -1426,6 +1341,9 @@ private:
 				case '3':
 					choice = 3;
 					break;
+				case '4':
+					choice = 4;
+					break;
 				case KEY_UP:
 					if (highlight > 0)
 					{
@@ -1433,7 +1351,7 @@ private:
 					}
 					break;
 				case KEY_DOWN:
-					if (highlight < 2)
+					if (highlight < 3)
 					{
 						highlight++;
 					}
@@ -1464,6 +1382,10 @@ private:
 				break;
 			case 3:
 				ShowSetColorNumMenu();
+				break;
+			case 4:
+				ShowSetFieldSizeMenu();
+				break;
 			default:
 				break;
 			}
@@ -1536,24 +1458,24 @@ private:
 				break;
 			}
 		}
-		SetwaitCount(choice);
+		SetFallSpeed(choice);
 		clear();
 
 		return;
 	}
 
-	void SetwaitCount(int choice)
+	void SetFallSpeed(int choice)
 	{
 		switch (choice)
 		{
 		case 1:
-			waitCount = 40000;
+			fallSpeed = 1;
 			break;
 		case 2:
-			waitCount = 20000;
+			fallSpeed = 2;
 			break;
 		case 3:
-			waitCount = 10000;
+			fallSpeed = 4;
 			break;
 		default:
 			break;
@@ -1578,12 +1500,100 @@ private:
 
 		while (1)
 		{
-			mvprintw(LINES / 2, COLS / 2 - 8, " 1. 300  Seconds ");
-			mvprintw(LINES / 2 + 1, COLS / 2 - 8, " 2. 600  Seconds ");
-			mvprintw(LINES / 2 + 2, COLS / 2 - 8, " 3. 1200 Seconds ");
+			mvprintw(LINES / 2, COLS / 2 - 8, " 1. 300  Seconds ");
+			mvprintw(LINES / 2 + 1, COLS / 2 - 8, " 2. 600  Seconds ");
+			mvprintw(LINES / 2 + 2, COLS / 2 - 8, " 3. 1200 Seconds ");
+
+			// Highlight the current option
+			mvchgat(LINES / 2 + highlight, COLS / 2 - 8, 17, A_REVERSE, 0, NULL);
+
+			ch = getch();
+
+			switch (ch)
+			{
+			case '1':
+				choice = 1;
+				break;
+			case '2':
+				choice = 2;
+				break;
+			case '3':
+				choice = 3;
+				break;
+			case KEY_UP:
+				if (highlight > 0)
+				{
+					highlight--;
+				}
+				break;
+			case KEY_DOWN:
+				if (highlight < 2)
+				{
+					highlight++;
+				}
+				break;
+			case '\n':
+				choice = highlight + 1;
+				break;
+			case 'q':
+				clear();
+				return; // exit
+			default:
+				break;
+			}
+
+			if (choice != 0)
+			{
+				break;
+			}
+		}
+		SetmaxGameDuration(choice);
+		clear();
+
+		return;
+	}
+
+	void SetmaxGameDuration(int choice)
+	{
+		switch (choice)
+		{
+		case 1:
+			maxGameDuration = 300;
+			break;
+		case 2:
+			maxGameDuration = 600;
+			break;
+		case 3:
+			maxGameDuration = 1200;
+			break;
+		default:
+			break;
+		}
+		return;
+	}
+
+	void ShowSetColorNumMenu()
+	{
+		clear();
+
+		int choice = 0;
+		int highlight = 0;
+		int ch;
+
+		mvprintw(LINES / 2 - 2, COLS / 2 - 15, "Set the Number of Colors for Puyo");
+
+		mvprintw(LINES - 2, 0, "Press Up Down Enter or Number Key to Choose");
+
+		mvprintw(LINES - 1, 0, "Press 'q' to Quit");
+		refresh();
+
+		while (1)
+		{
+			mvprintw(LINES / 2, COLS / 2 - 6, " 1. 4 Colors ");
+			mvprintw(LINES / 2 + 1, COLS / 2 - 6, " 2. 5 Colors ");
 
 			// Highlight the current option
-			mvchgat(LINES / 2 + highlight, COLS / 2 - 8, 17, A_REVERSE, 0, NULL);
+			mvchgat(LINES / 2 + highlight, COLS / 2 - 6, 13, A_REVERSE, 0, NULL);
 
 			ch = getch();
 
@@ -1595,9 +1605,6 @@ private:
 			case '2':
 				choice = 2;
 				break;
-			case '3':
-				choice = 3;
-				break;
 			case KEY_UP:
 				if (highlight > 0)
 				{
@@ -1605,7 +1612,7 @@ private:
 				}
 				break;
 			case KEY_DOWN:
-				if (highlight < 2)
+				if (highlight < 1)
 				{
 					highlight++;
 				}
@@ -1625,32 +1632,13 @@ private:
 				break;
 			}
 		}
-		SetmaxGameDuration(choice);
+		control.SetColorNum(choice + 3);
 		clear();
 
 		return;
 	}
 
-	void SetmaxGameDuration(int choice)
-	{
-		switch (choice)
-		{
-		case 1:
-			maxGameDuration = 300;
-			break;
-		case 2:
-			maxGameDuration = 600;
-			break;
-		case 3:
-			maxGameDuration = 1200;
-			break;
-		default:
-			break;
-		}
-		return;
-	}
-
-	void ShowSetColorNumMenu()
+	void ShowSetFieldSizeMenu()
 	{
 		clear();
 
@@ -1658,7 +1646,7 @@ private:
 		int highlight = 0;
 		int ch;
 
-		mvprintw(LINES / 2 - 2, COLS / 2 - 15, "Set the Number of Colors for Puyo");
+		mvprintw(LINES / 2 - 2, COLS / 2 - 7, "Set the Field Size");
 
 		mvprintw(LINES - 2, 0, "Press Up Down Enter or Number Key to Choose");
 
@@ -1667,11 +1655,11 @@ private:
 
 		while (1)
 		{
-			mvprintw(LINES / 2, COLS / 2 - 6, " 1. 4 Colors ");
-			mvprintw(LINES / 2 + 1, COLS / 2 - 6, " 2. 5 Colors ");
+			mvprintw(LINES / 2, COLS / 2 - 10, " 1. Fit the Terminal  ");
+			mvprintw(LINES / 2 + 1, COLS / 2 - 10, " 2. Standard 6 x 13   ");
 
 			// Highlight the current option
-			mvchgat(LINES / 2 + highlight, COLS / 2 - 6, 13, A_REVERSE, 0, NULL);
+			mvchgat(LINES / 2 + highlight, COLS / 2 - 10, 22, A_REVERSE, 0, NULL);
 
 			ch = getch();
 
@@ -1710,91 +1698,210 @@ private:
 				break;
 			}
 		}
-		control.SetColorNum(choice + 3);
+		// The standard field has a hidden 14th row on top, where the pairs appear
+		standardField = (choice == 2);
 		clear();
 
 		return;
 	}
 
-	void Display()
+	// 盤面を描画する (前回から変わったセルのみ出力される)
+	// 落下中の組ぷよは着地済みぷよの上に重ねて描く
+	void DrawField(PuyoArrayActive &active, PuyoArrayStack &stack)
 	{
-		// 文字の色と背景の色のペアを初期化する
-		init_pair(0, COLOR_WHITE, COLOR_BLACK);
-		init_pair(1, COLOR_RED, COLOR_BLACK);
-		init_pair(2, COLOR_BLUE, COLOR_BLACK);
-		init_pair(3, COLOR_GREEN, COLOR_BLACK);
-		init_pair(4, COLOR_YELLOW, COLOR_BLACK);
-		init_pair(5, COLOR_MAGENTA, COLOR_WHITE);
-		init_pair(6, COLOR_CYAN, COLOR_BLACK);
-		init_pair(7, COLOR_MAGENTA, COLOR_BLACK);
-
-		// ぷよ表示
-		for (int y = 0; y < active.GetLine(); y++)
+		int axisY = -1, axisX = -1, childY = -1, childX = -1;
+		if (active.IsFalling())
+		{
+			axisY = active.GetAxisY();
+			axisX = active.GetAxisX();
+			childY = active.GetChildY();
+			childX = active.GetChildX();
+		}
+		for (int y = 0; y < (int)stack.GetLine(); y++)
 		{
-			for (int x = 0; x < active.GetColumn(); x++)
+			for (int x = 0; x < (int)stack.GetColumn(); x++)
 			{
-				if (active.GetValue(y, x) != NONE)
+				if ((y == axisY && x == axisX) || (y == childY && x == childX))
 				{
-					switch (active.GetValue(y, x))
-					{
-					case RED:
-						attrset(COLOR_PAIR(1));
-						mvaddch(y, x, 'R');
-						break;
-					case BLUE:
-						attrset(COLOR_PAIR(2));
-						mvaddch(y, x, 'B');
-						break;
-					case GREEN:
-						attrset(COLOR_PAIR(3));
-						mvaddch(y, x, 'G');
-						break;
-					case YELLOW:
-						attrset(COLOR_PAIR(4));
-						mvaddch(y, x, 'Y');
-						break;
-					case PURPLE:
-						attrset(COLOR_PAIR(7));
-						mvaddch(y, x, 'P');
-						break;
-					default:
-						break;
-					}
+					continue;
 				}
-				else
+				renderer.DrawCell(y, x, PuyoRenderer::Glyph(stack.GetValue(y, x)));
+			}
+		}
+		if (active.IsFalling())
+		{
+			renderer.DrawCell(axisY, axisX, PuyoRenderer::Glyph(active.GetPair().axis));
+			renderer.DrawCell(childY, childX, PuyoRenderer::Glyph(active.GetPair().child));
+		}
+	}
+
+	// 消滅するぷよを点滅させる (表示はタイムラインに積んでメインループで進める)
+	void OnVanish(PuyoArrayActive &active, PuyoArrayStack &stack, const std::vector<PuyoGroup> &groups, const std::vector<unsigned int> &cells)
+	{
+		if (!animate)
+		{
+			return;
+		}
+		PuyoTimeline::Clip &clip = timeline.Push(PuyoTimeline::BLINK, BLINK_FRAMES, BLINK_FRAME_TIME, NowMilliseconds());
+		clip.field.Pack(stack);
+		clip.groups = groups;
+		clip.cells = cells;
+	}
+
+	// 落下したぷよを1段ずつ動かして見せる (表示はタイムラインに積んでメインループで進める)
+	void OnFall(PuyoArrayActive &active, PuyoArrayStack &stack, const std::vector<PuyoFall> &falls)
+	{
+		unsigned int distance = 0;
+		for (size_t i = 0; i < falls.size(); i++)
+		{
+			distance = std::max(distance, falls[i].to - falls[i].from);
+		}
+		if (!animate || distance == 0)
+		{
+			return;
+		}
+		PuyoTimeline::Clip &clip = timeline.Push(PuyoTimeline::FALL, distance, FALL_FRAME_TIME, NowMilliseconds());
+		clip.field.Pack(stack);
+		clip.falls = falls;
+	}
+
+	// アニメーションの現在のフレームを描画する
+	void DrawAnimation(long long now)
+	{
+		const PuyoTimeline::Clip &clip = timeline.GetClip();
+		int frame = timeline.GetFrame(now);
+		clip.field.Unpack(animationStack);
+		for (int y = 0; y < (int)animationStack.GetLine(); y++)
+		{
+			for (int x = 0; x < (int)animationStack.GetColumn(); x++)
+			{
+				renderer.DrawCell(y, x, PuyoRenderer::Glyph(animationStack.GetValue(y, x)));
+			}
+		}
+
+		unsigned int column = animationStack.GetColumn();
+		if (clip.kind == PuyoTimeline::ALL_CLEAR)
+		{
+			DrawAllClear();
+			return;
+		}
+		if (clip.kind == PuyoTimeline::BLINK)
+		{
+			// frame の奇偶によってパターンを切り替える
+			if (frame % 2 != 0)
+			{
+				size_t cell = 0;
+				for (size_t g = 0; g < clip.groups.size(); g++)
 				{
-					switch (stack.GetValue(y, x))
+					for (int n = 0; n < clip.groups[g].size; n++, cell++)
 					{
-					case NONE:
-						attrset(COLOR_PAIR(0));
-						mvaddch(y, x, '.');
-						break;
-					case RED:
-						attrset(COLOR_PAIR(1));
-						mvaddch(y, x, 'R');
-						break;
-					case BLUE:
-						attrset(COLOR_PAIR(2));
-						mvaddch(y, x, 'B');
-						break;
-					case GREEN:
-						attrset(COLOR_PAIR(3));
-						mvaddch(y, x, 'G');
-						break;
-					case YELLOW:
-						attrset(COLOR_PAIR(4));
-						mvaddch(y, x, 'Y');
-						break;
-					case PURPLE:
-						attrset(COLOR_PAIR(7));
-						mvaddch(y, x, 'P');
-						break;
-					default:
-						mvaddch(y, x, '?');
-						break;
+						renderer.DrawCell(clip.cells[cell] / column, clip.cells[cell] % column, PuyoRenderer::Glyph(clip.groups[g].color));
 					}
 				}
 			}
+			return;
+		}
+
+		// まだ着地していないぷよは落下先を空けて途中の位置に描く
+		unsigned int step = frame + 1;
+		const std::vector<PuyoFall> &falls = clip.falls;
+		for (size_t i = 0; i < falls.size(); i++)
+		{
+			if (falls[i].from + step < falls[i].to)
+			{
+				renderer.DrawCell(falls[i].to, falls[i].x, PuyoRenderer::Glyph(NONE));
+			}
+		}
+		for (size_t i = 0; i < falls.size(); i++)
+		{
+			if (falls[i].from + step < falls[i].to)
+			{
+				renderer.DrawCell(falls[i].from + step, falls[i].x, PuyoRenderer::Glyph(falls[i].color));
+			}
+		}
+	}
+
+	// The listeners only draw into the screen; the next Render() shows it
+	void OnScore(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		int addScore = stack.GetNowscore();
+		int chain = control.GetChainCount();
+		char msg[32];
+
+		if (addScore > 0)
+		{
+			snprintf(msg, sizeof(msg), "+ %d     ", addScore);
+			renderer.DrawText(4, COLS - 29, 0, msg);
+		}
+
+		if (chain > 1)
+		{
+			snprintf(msg, sizeof(msg), "Chain %d!", chain);
+			renderer.DrawText(4, COLS - 14, 0, msg);
+		}
+
+		// 盤面が空になったら連鎖はここで終わる．表示は連鎖のアニメーションの後にする
+		if (stack.CountPuyo() == 0)
+		{
+			if (animate)
+			{
+				PuyoTimeline::Clip &clip = timeline.Push(PuyoTimeline::ALL_CLEAR, 1, ALL_CLEAR_TIME, NowMilliseconds());
+				clip.field.Pack(stack);
+			}
+			else
+			{
+				DrawAllClear();
+			}
+		}
+	}
+
+	void DrawAllClear()
+	{
+		renderer.DrawText(LINES / 2 + 1, COLS / 2 - 10, 0, "ALL CLEAR!");
+	}
+
+	void OnScoreClear()
+	{
+		renderer.DrawText(4, COLS - 29, 0, "                            ");
+		renderer.DrawText(LINES / 2 + 1, COLS / 2 - 10, 0, "           ");
+	}
+
+	// Draw the labels that do not change during a game
+	// Call once after the screen was cleared
+	void DisplayStatic()
+	{
+		renderer.Invalidate();
+		hud.count = -1;
+		hud.score = -1;
+		hud.highScore = false;
+		hud.maxChain = -1;
+		hud.gameDuration = -1;
+
+		renderer.DrawText(6, COLS - 35, 0, "Next Puyo: ");
+
+		renderer.DrawText(LINES - 1, 0, 0, "Q: Quit");
+		renderer.DrawText(LINES - 2, 0, 0, "s: Pause/Resume");
+		renderer.DrawText(LINES - 3, 0, 0, "p: Performance");
+
+		renderer.DrawText(LINES / 2 + 1, COLS - 35, 0, "Use the following keys to play:");
+		renderer.DrawText(LINES / 2 + 3, COLS - 30, 0, "Arrow Left: Move Left");
+		renderer.DrawText(LINES / 2 + 4, COLS - 30, 0, "Arrow Right: Move Right");
+		renderer.DrawText(LINES / 2 + 5, COLS - 30, 0, "Arrow Down: Move Down");
+		renderer.DrawText(LINES / 2 + 6, COLS - 30, 0, "z: Rotate");
+	}
+
+	void Display()
+	{
+		// ぷよ表示 (アニメーション中はそのフレーム)
+		long long now = NowMilliseconds();
+		timeline.Advance(now);
+		if (timeline.IsEmpty())
+		{
+			DrawField(active, stack);
+		}
+		else
+		{
+			DrawAnimation(now);
 		}
 
 		// Display NextPuyo
@@ -1802,84 +1909,336 @@ private:
 		{
 			for (int x = 0; x < 2; x++)
 			{
-
-				switch (active.GetNextPuyoValue(y, x))
-				{
-				case RED:
-					attrset(COLOR_PAIR(1));
-					mvaddch(y + 5, x + COLS - 23, 'R');
-					break;
-				case BLUE:
-					attrset(COLOR_PAIR(2));
-					mvaddch(y + 5, x + COLS - 23, 'B');
-					break;
-				case GREEN:
-					attrset(COLOR_PAIR(3));
-					mvaddch(y + 5, x + COLS - 23, 'G');
-					break;
-				case YELLOW:
-					attrset(COLOR_PAIR(4));
-					mvaddch(y + 5, x + COLS - 23, 'Y');
-					break;
-				case PURPLE:
-					attrset(COLOR_PAIR(7));
-					mvaddch(y + 5, x + COLS - 23, 'P');
-					break;
-				case NONE:
-					attrset(COLOR_PAIR(0));
-					mvaddch(y + 5, x + COLS - 23, '.');
-				default:
-					break;
-				}
+				renderer.DrawCell(y + 5, x + COLS - 23, PuyoRenderer::Glyph(active.GetNextPuyoValue(y, x)));
 			}
 		}
 
-		// 情報表示
+		// 情報表示 (値が変わった項目だけ書き直す)
 		int count = active.CountPuyo() + stack.CountPuyo();
 		int score = stack.GetScore();
-		int topscore = GetTopScore();
+		int maxChain = control.GetMaxChain();
 		int gameDuration = CalculateGameDuration();
-
 		char msg[256];
-		sprintf(msg, "Field: %d x %d, Puyo number: %03d", active.GetLine(), active.GetColumn(), count);
-		attrset(COLOR_PAIR(0));
-		mvaddstr(2, COLS - 35, msg);
 
-		char scoreMsg[256];
-		sprintf(scoreMsg, "Score: %d", score);
-		attrset(COLOR_PAIR(6));
-		mvaddstr(3, COLS - 35, scoreMsg);
-
-		if (score > topscore)
+		if (count != hud.count)
 		{
-			attrset(COLOR_PAIR(5));
-			mvaddstr(3, COLS - 15, "HIGH SCORE");
+			hud.count = count;
+			snprintf(msg, sizeof(msg), "Field: %d x %d, Puyo number: %03d", active.GetLine(), active.GetColumn(), count);
+			renderer.DrawText(2, COLS - 35, 0, msg);
 		}
 
-		attrset(COLOR_PAIR(0));
-		mvprintw(5, COLS - 15, "Max Chain: %d", control.GetMaxChain());
+		if (score != hud.score)
+		{
+			hud.score = score;
+			snprintf(msg, sizeof(msg), "Score: %d", score);
+			renderer.DrawText(3, COLS - 35, COLOR_PAIR(PuyoRenderer::PAIR_SCORE), msg);
 
-		char timer[256];
-		sprintf(timer, "Game Time: %ds / %ds", gameDuration, maxGameDuration);
-		attrset(COLOR_PAIR(0));
-		mvaddstr(LINES / 2 + 1, 2, timer);
+			if (!hud.highScore && score > GetTopScore())
+			{
+				hud.highScore = true;
+				renderer.DrawText(3, COLS - 15, COLOR_PAIR(PuyoRenderer::PAIR_HIGHSCORE), "HIGH SCORE");
+			}
+		}
 
-		mvprintw(6, COLS - 35, "Next Puyo: ");
+		if (maxChain != hud.maxChain)
+		{
+			hud.maxChain = maxChain;
+			snprintf(msg, sizeof(msg), "Max Chain: %d", maxChain);
+			renderer.DrawText(5, COLS - 15, 0, msg);
+		}
 
-		mvprintw(LINES - 1, 0, "Q: Quit");
-		mvprintw(LINES - 2, 0, "s: Pause/Resume");
+		if (gameDuration != hud.gameDuration)
+		{
+			hud.gameDuration = gameDuration;
+			snprintf(msg, sizeof(msg), "Game Time: %ds / %ds", gameDuration, maxGameDuration);
+			renderer.DrawText(LINES / 2 + 1, 2, 0, msg);
+		}
 
-		mvprintw(LINES / 2 + 1, COLS - 35, "Use the following keys to play:");
-		mvprintw(LINES / 2 + 3, COLS - 30, "Arrow Left: Move Left");
-		mvprintw(LINES / 2 + 4, COLS - 30, "Arrow Right: Move Right");
-		mvprintw(LINES / 2 + 5, COLS - 30, "Arrow Down: Move Down");
-		mvprintw(LINES / 2 + 6, COLS - 30, "z: Rotate");
 		refresh();
 	}
 };
 
-int main()
+// Let the AI play without a terminal and print the result
+// Used for load testing the engine and the search
+int RunBotHeadless(int pieces, unsigned int line, unsigned int column, int rollouts)
+{
+	PuyoArrayActive active;
+	PuyoArrayStack stack;
+	PuyoControl control;
+	PuyoBot bot;
+	bot.SetColorNum(control.GetColorNum());
+	bot.SetRolloutNum(rollouts);
+	active.ChangeSize(line, column);
+	stack.ChangeSize(line, column);
+	control.SetSpawnColumn(PuyoControl::SpawnColumnFor(column));
+	bot.SetSpawnColumn(control.GetSpawnColumn());
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int placed = 0;
+	while (placed < pieces)
+	{
+		control.GeneratePuyo(active, stack);
+		if (bot.IsDead(stack))
+		{
+			break;
+		}
+
+		std::vector<PuyoPair> pairs;
+		for (int i = 0; i < 3; i++)
+		{
+			PuyoPair pair;
+			pair.axis = active.GetNextPuyoValue(i, 0);
+			pair.child = active.GetNextPuyoValue(i, 1);
+			pairs.push_back(pair);
+		}
+		PuyoPlacement placement = bot.Think(stack, pairs);
+
+		// Drop the pair straight to its placement instead of moving it step by step
+		active.ClearPiece();
+		if (placement.rotation < 0 || !bot.Place(stack, pairs[0], placement))
+		{
+			break;
+		}
+		control.ResolveChain(active, stack);
+		placed++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("field %u x %u, %d threads, beam %d, %d rollouts\n", line, column, bot.GetThreadNum(), bot.GetBeamWidth(), bot.GetRolloutNum());
+	printf("pieces %d, score %d, max chain %d\n", placed, stack.GetScore(), control.GetMaxChain());
+	printf("%.3f s, %.1f pieces/s\n", seconds, placed / seconds);
+	return 0;
+}
+
+// Replay a recorded game without a terminal and check it reaches the recorded score
+int RunReplayHeadless(const PuyoReplay &replay)
+{
+	PuyoArrayActive active;
+	PuyoArrayStack stack;
+	PuyoControl control;
+	replay.Start(control, active, stack);
+	for (size_t i = 0; i < replay.GetEvents().size(); i++)
+	{
+		replay.Apply(control, active, stack, i);
+	}
+
+	printf("field %u x %u, seed %llu, %zu events, %zu keyframes\n", replay.GetLine(), replay.GetColumn(), (unsigned long long)replay.GetSeed(), replay.GetEvents().size(), replay.GetKeyframes().size());
+	printf("score %d, max chain %d, recorded score %d\n", stack.GetScore(), control.GetMaxChain(), replay.GetFinalScore());
+	if (stack.GetScore() != replay.GetFinalScore())
+	{
+		fprintf(stderr, "replay diverged from the recorded game\n");
+		return 1;
+	}
+	return 0;
+}
+
+// Make a curses screen of the given size that writes to /dev/null the current screen
+// Used to run the drawing code without a terminal; returns NULL if curses refuses
+SCREEN *OpenNullScreen(unsigned int lines, unsigned int columns)
+{
+	static FILE *null = fopen("/dev/null", "r+");
+	const char *term = getenv("TERM");
+	if (term == NULL || term[0] == '\0')
+	{
+		term = "xterm";
+	}
+	char text[16];
+	snprintf(text, sizeof(text), "%u", lines);
+	setenv("LINES", text, 1);
+	snprintf(text, sizeof(text), "%u", columns);
+	setenv("COLUMNS", text, 1);
+	SCREEN *screen = (null != NULL) ? newterm(term, null, null) : NULL;
+	if (screen == NULL)
+	{
+		return NULL;
+	}
+	set_term(screen);
+	start_color();
+	PuyoRenderer::Init();
+	return screen;
+}
+
+void CloseNullScreen(SCREEN *screen)
+{
+	endwin();
+	delscreen(screen);
+}
+
+// Play scripted games through the real game loop without a terminal
+// A steady, repeatable load for profile-guided builds and perf record
+int RunTrainWorkload(int games, int pieces, unsigned int line, unsigned int column)
 {
+	// Draw on a terminal twice the size of the field, as the game would
+	SCREEN *screen = OpenNullScreen(std::max(24u, line * 2), std::max(80u, column * 2));
+	if (screen == NULL)
+	{
+		fprintf(stderr, "cannot open a null terminal\n");
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long long total;
+	{
+		PuyoGame game;
+		total = game.RunWorkload(games, pieces, 1, line, column);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CloseNullScreen(screen);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("field %u x %u, %d games of up to %d pieces\n", line, column, games, pieces);
+	printf("total score %lld\n", total);
+	printf("%.3f s\n", seconds);
+	return 0;
+}
+
+// Measure the engine hot paths and Display() on standard and terminal-sized fields
+// Writes the results as JSON and, given a baseline, fails if anything got slower than threshold
+int RunBenchmark(const char *output, const char *baseline, double threshold)
+{
+	// line, column: the standard 6x13 field with its hidden row on top (PuyoStandardField,
+	// which PuyoChainSimulator resolves with the fixed-size code), the smallest field
+	// the game spawns on, and the fields a large and a very large terminal give
+	static const unsigned int sizes[][2] = {{14, 6}, {13, 8}, {33, 120}, {100, 300}};
+	PuyoBenchmark bench;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		std::vector<PuyoBenchField> corpus;
+		PuyoBenchmark::MakeCorpus(sizes[i][0], sizes[i][1], 32, i + 1, corpus);
+		bench.RunEngine(corpus);
+
+		// Draw on a terminal twice the size of the field, as the game would
+		SCREEN *screen = OpenNullScreen(std::max(24u, sizes[i][0] * 2), std::max(80u, sizes[i][1] * 2));
+		if (screen == NULL)
+		{
+			fprintf(stderr, "cannot open a null terminal, skipping Display\n");
+			continue;
+		}
+		{
+			PuyoGame game;
+			game.BenchmarkDisplay(bench, corpus);
+		}
+		CloseNullScreen(screen);
+	}
+
+	bench.Print(stdout);
+	if (output != NULL && !bench.Save(output))
+	{
+		fprintf(stderr, "cannot write %s\n", output);
+		return 1;
+	}
+	if (baseline != NULL)
+	{
+		std::vector<PuyoBenchResult> base;
+		if (!PuyoBenchmark::Load(baseline, base))
+		{
+			fprintf(stderr, "cannot read baseline %s\n", baseline);
+			return 1;
+		}
+		printf("\ncompared with %s:\n", baseline);
+		int regressions = bench.Compare(base, threshold, stdout);
+		if (regressions > 0)
+		{
+			printf("%d regressions over %.0f%%\n", regressions, threshold * 100);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	// puyo8 --train-workload [games] [pieces] [lines] [columns]
+	// The default field is the one an 80 x 24 terminal gives
+	if (argc >= 2 && strcmp(argv[1], "--train-workload") == 0)
+	{
+		int games = (argc >= 3) ? atoi(argv[2]) : 20;
+		int pieces = (argc >= 4) ? atoi(argv[3]) : 500;
+		unsigned int line = (argc >= 5) ? atoi(argv[4]) : 12;
+		unsigned int column = (argc >= 6) ? atoi(argv[5]) : 40;
+		if (line < 2 || column < 2)
+		{
+			fprintf(stderr, "the field must be at least 2 x 2\n");
+			return 1;
+		}
+		return RunTrainWorkload(games, pieces, line, column);
+	}
+
+	// puyo8 --bench [output.json] [--baseline <file>] [--threshold <percent>]
+	if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+	{
+		const char *output = NULL;
+		const char *baseline = NULL;
+		double threshold = 0.10;
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			{
+				baseline = argv[++i];
+			}
+			else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			{
+				threshold = atof(argv[++i]) / 100;
+			}
+			else
+			{
+				output = argv[i];
+			}
+		}
+		return RunBenchmark(output, baseline, threshold);
+	}
+
+	// puyo8 --replay <file> [--fast] [--seek <seconds>]
+	if (argc >= 3 && strcmp(argv[1], "--replay") == 0)
+	{
+		bool fast = false;
+		int seekSeconds = 0;
+		for (int i = 3; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--fast") == 0)
+			{
+				fast = true;
+			}
+			else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc)
+			{
+				seekSeconds = std::max(0, atoi(argv[++i]));
+			}
+		}
+		PuyoReplay replay;
+		if (!replay.Load(argv[2]))
+		{
+			fprintf(stderr, "cannot read replay %s\n", argv[2]);
+			return 1;
+		}
+		if (fast)
+		{
+			return RunReplayHeadless(replay);
+		}
+		PuyoGame game;
+		game.RunReplay(replay, seekSeconds);
+		return 0;
+	}
+
+	// puyo8 --bot [pieces] [lines] [columns] [rollouts]
+	if (argc >= 2 && strcmp(argv[1], "--bot") == 0)
+	{
+		int pieces = (argc >= 3) ? atoi(argv[2]) : 1000;
+		unsigned int line = (argc >= 4) ? atoi(argv[3]) : 13;
+		unsigned int column = (argc >= 5) ? atoi(argv[4]) : 8;
+		int rollouts = (argc >= 6) ? atoi(argv[5]) : 0;
+		if (line < 2 || column < 2)
+		{
+			fprintf(stderr, "the field must be at least 2 x 2\n");
+			return 1;
+		}
+		return RunBotHeadless(pieces, line, column, rollouts);
+	}
+
 	PuyoGame game;
 
 	game.Run();
@@ -0,0 +1,235 @@
+#ifndef PUYOBENCH_H
+#define PUYOBENCH_H
+
+// 盤面処理の計測
+// 決まった種から作った盤面の組(コーパス)に対して各操作の1回あたりの時間を測り，
+// JSONに書き出して以前の結果(ベースライン)と比べる
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "puyoengine.h"
+
+// 計測に使う盤面 (落下中の組ぷよと着地済みぷよ)
+struct PuyoBenchField
+{
+	PuyoArrayActive active;
+	PuyoArrayStack stack;
+};
+
+struct PuyoBenchResult
+{
+	std::string name;
+	unsigned int line;
+	unsigned int column;
+	// 計測した操作の回数
+	long long iterations;
+	// 1回あたりの時間 (ナノ秒，計測ラウンドの中央値)
+	double nanoseconds;
+};
+
+class PuyoBenchmark
+{
+public:
+	// secondsは1つの操作を計測する時間の目安
+	PuyoBenchmark(double seconds = 0.2) : minSeconds(seconds), sink(0) {}
+
+	// line行column列の盤面をcount個作る
+	// 列ごとにランダムな高さまで4色のぷよを積み，いくつかの列には穴をあけて浮いたぷよを作る
+	// 落下中の組ぷよは最上段の中央に横向きで置く
+	static void MakeCorpus(unsigned int line, unsigned int column, int count, uint64_t seed, std::vector<PuyoBenchField> &corpus)
+	{
+		PuyoRandom random(seed);
+		corpus.assign(count, PuyoBenchField());
+		for (int i = 0; i < count; i++)
+		{
+			PuyoBenchField &field = corpus[i];
+			field.active.ChangeSize(line, column);
+			field.stack.ChangeSize(line, column);
+			for (unsigned int x = 0; x < column; x++)
+			{
+				unsigned int height = random.Below(line - 2);
+				for (unsigned int h = 0; h < height; h++)
+				{
+					field.stack.SetValue(line - 1 - h, x, static_cast<puyocolor>(RED + random.Below(4)));
+				}
+				if (height >= 2 && random.Below(4) == 0)
+				{
+					field.stack.SetValue(line - 1 - random.Below(height - 1), x, NONE);
+				}
+			}
+			PuyoPair pair;
+			pair.axis = static_cast<puyocolor>(RED + random.Below(4));
+			pair.child = static_cast<puyocolor>(RED + random.Below(4));
+			field.active.SetPiece(0, column / 2 - 1, 0, pair);
+		}
+	}
+
+	// コーパスの各盤面に対してop(field)を行う時間を測る
+	// 毎ラウンド，計測の外で作業用の盤面をコーパスの状態に戻してから全盤面に1回ずつ適用する
+	template <class Operation>
+	void Measure(const std::string &name, const std::vector<PuyoBenchField> &corpus, Operation op)
+	{
+		std::vector<PuyoBenchField> work(corpus);
+		std::vector<double> rounds;
+		// 盤面を戻す時間も含めた経過時間で打ち切る (速い操作で戻す時間が支配的になるため)
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		while (rounds.size() < MIN_ROUNDS || std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() < minSeconds)
+		{
+			for (size_t i = 0; i < corpus.size(); i++)
+			{
+				work[i].active = corpus[i].active;
+				work[i].stack = corpus[i].stack;
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < work.size(); i++)
+			{
+				op(work[i]);
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			rounds.push_back(elapsed.count() * 1e9 / work.size());
+		}
+
+		std::sort(rounds.begin(), rounds.end());
+		PuyoBenchResult result;
+		result.name = name;
+		result.line = corpus[0].stack.GetLine();
+		result.column = corpus[0].stack.GetColumn();
+		result.iterations = (long long)rounds.size() * corpus.size();
+		result.nanoseconds = rounds[rounds.size() / 2];
+		results.push_back(result);
+	}
+
+	// 盤面操作をひととおり計測する
+	void RunEngine(const std::vector<PuyoBenchField> &corpus)
+	{
+		PuyoControl control;
+		Measure("CountPuyo", corpus, [&](PuyoBenchField &field) {
+			sink = sink + field.stack.CountPuyo();
+		});
+		Measure("VanishPuyo", corpus, [&](PuyoBenchField &field) {
+			sink = sink + control.VanishPuyo(field.active, field.stack);
+		});
+		Measure("LandingPuyo", corpus, [&](PuyoBenchField &field) {
+			sink = sink + control.LandingPuyo(field.active, field.stack);
+		});
+		Measure("MoveLeft", corpus, [&](PuyoBenchField &field) {
+			control.MoveLeft(field.active, field.stack);
+		});
+		Measure("MoveRight", corpus, [&](PuyoBenchField &field) {
+			control.MoveRight(field.active, field.stack);
+		});
+		Measure("MoveDown", corpus, [&](PuyoBenchField &field) {
+			control.MoveDown(field.active, field.stack);
+		});
+		Measure("Rotate", corpus, [&](PuyoBenchField &field) {
+			control.Rotate(field.active, field.stack);
+		});
+		// 落下と連鎖を最後まで計算する (標準の大きさの盤面は固定サイズの盤面で計算される)
+		PuyoChainSimulator simulator;
+		PuyoChainResult result;
+		Measure("Resolve", corpus, [&](PuyoBenchField &field) {
+			simulator.Resolve(field.stack, result);
+			sink = sink + result.score;
+		});
+	}
+
+	const std::vector<PuyoBenchResult> &GetResults() const
+	{
+		return results;
+	}
+
+	void Print(FILE *out) const
+	{
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			fprintf(out, "%-14s %4u x %-4u %12.1f ns\n", results[i].name.c_str(), results[i].line, results[i].column, results[i].nanoseconds);
+		}
+	}
+
+	// 1行に1件ずつJSONで書き出す
+	bool Save(const std::string &filename) const
+	{
+		FILE *file = fopen(filename.c_str(), "w");
+		if (file == NULL)
+		{
+			return false;
+		}
+		fprintf(file, "{\n\t\"benchmarks\": [\n");
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const PuyoBenchResult &result = results[i];
+			fprintf(file, "\t\t{\"name\": \"%s\", \"line\": %u, \"column\": %u, \"iterations\": %lld, \"ns_per_op\": %.2f}%s\n",
+					result.name.c_str(), result.line, result.column, result.iterations, result.nanoseconds, (i + 1 < results.size()) ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+		return fclose(file) == 0;
+	}
+
+	// Saveで書き出したJSONを読む
+	static bool Load(const std::string &filename, std::vector<PuyoBenchResult> &loaded)
+	{
+		FILE *file = fopen(filename.c_str(), "r");
+		if (file == NULL)
+		{
+			return false;
+		}
+		loaded.clear();
+		char text[512];
+		while (fgets(text, sizeof(text), file) != NULL)
+		{
+			char name[64];
+			PuyoBenchResult result;
+			const char *entry = strstr(text, "{\"name\"");
+			if (entry != NULL && sscanf(entry, "{\"name\": \"%63[^\"]\", \"line\": %u, \"column\": %u, \"iterations\": %lld, \"ns_per_op\": %lf",
+										name, &result.line, &result.column, &result.iterations, &result.nanoseconds) == 5)
+			{
+				result.name = name;
+				loaded.push_back(result);
+			}
+		}
+		fclose(file);
+		return true;
+	}
+
+	// ベースラインと比べ，threshold (割合) を超えて遅くなった操作を表示する
+	// 遅くなった操作の数を返す
+	int Compare(const std::vector<PuyoBenchResult> &baseline, double threshold, FILE *out) const
+	{
+		int regressions = 0;
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const PuyoBenchResult &result = results[i];
+			for (size_t j = 0; j < baseline.size(); j++)
+			{
+				const PuyoBenchResult &base = baseline[j];
+				if (base.name != result.name || base.line != result.line || base.column != result.column)
+				{
+					continue;
+				}
+				double change = result.nanoseconds / base.nanoseconds - 1;
+				bool regressed = change > threshold;
+				if (regressed)
+				{
+					regressions++;
+				}
+				fprintf(out, "%-14s %4u x %-4u %12.1f -> %12.1f ns %+7.1f%%%s\n", result.name.c_str(), result.line, result.column,
+						base.nanoseconds, result.nanoseconds, change * 100, regressed ? "  REGRESSION" : "");
+				break;
+			}
+		}
+		return regressions;
+	}
+
+private:
+	static const size_t MIN_ROUNDS = 5;
+	double minSeconds;
+	std::vector<PuyoBenchResult> results;
+	// 計測する操作の結果をここに足して，最適化で消されないようにする
+	volatile long long sink;
+};
+
+#endif
@@ -0,0 +1,810 @@
+#ifndef PUYOBOT_H
+#define PUYOBOT_H
+
+// ビームサーチで置き場所を決めるAIプレイヤー
+// 画面表示に依存しないので，ゲーム画面からも表示なしの実行からも使える
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <unordered_set>
+#include <algorithm>
+#include "puyoengine.h"
+
+// ワークスティーリング方式のスレッドプール
+// 各ワーカーが自分の両端キューの後ろから仕事を取り，空になったら他のワーカーのキューの前から盗む
+// ParallelForを呼んだスレッドもワーカー0として処理に加わる (入れ子の呼び出しには対応しない)
+class PuyoThreadPool
+{
+public:
+	explicit PuyoThreadPool(int threads = 0)
+	{
+		threadNum = threads;
+		if (threadNum <= 0)
+		{
+			threadNum = std::thread::hardware_concurrency();
+		}
+		if (threadNum <= 0)
+		{
+			threadNum = 1;
+		}
+		queues = new Queue[threadNum];
+		job = NULL;
+		generation = 0;
+		remaining = 0;
+		stop = false;
+		for (int t = 1; t < threadNum; t++)
+		{
+			threads_.push_back(std::thread(&PuyoThreadPool::WorkerLoop, this, t));
+		}
+	}
+
+	~PuyoThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (size_t t = 0; t < threads_.size(); t++)
+		{
+			threads_[t].join();
+		}
+		delete[] queues;
+	}
+
+	int GetThreadNum() const
+	{
+		return threadNum;
+	}
+
+	// task(index, worker)をindex = 0..count-1について実行し，すべて終わるまで待つ
+	// workerは0..GetThreadNum()-1で，ワーカーごとの作業領域の添字に使える
+	void ParallelFor(size_t count, const std::function<void(size_t, int)> &task)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		if (threadNum == 1)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				task(i, 0);
+			}
+			return;
+		}
+
+		job = &task;
+		remaining = count;
+		// 連続した範囲ごとに各ワーカーへ配る
+		for (int t = 0; t < threadNum; t++)
+		{
+			std::lock_guard<std::mutex> lock(queues[t].mutex);
+			for (size_t i = count * t / threadNum; i < count * (t + 1) / threadNum; i++)
+			{
+				queues[t].indices.push_back(i);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+		}
+		wake.notify_all();
+
+		RunTasks(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return remaining == 0; });
+		job = NULL;
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<size_t> indices;
+	};
+
+	int threadNum;
+	Queue *queues;
+	std::vector<std::thread> threads_;
+	const std::function<void(size_t, int)> *job;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned long long generation;
+	std::atomic<size_t> remaining;
+	bool stop;
+
+	// 仕事を1つ取り出す (自分のキューの後ろ，なければ他のキューの前)
+	bool TakeTask(int worker, size_t &index)
+	{
+		{
+			Queue &own = queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.indices.empty())
+			{
+				index = own.indices.back();
+				own.indices.pop_back();
+				return true;
+			}
+		}
+		for (int i = 1; i < threadNum; i++)
+		{
+			Queue &victim = queues[(worker + i) % threadNum];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.indices.empty())
+			{
+				index = victim.indices.front();
+				victim.indices.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void RunTasks(int worker)
+	{
+		size_t index;
+		while (TakeTask(worker, index))
+		{
+			(*job)(index, worker);
+			if (--remaining == 0)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+	void WorkerLoop(int worker)
+	{
+		unsigned long long seen = 0;
+		while (1)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stop || generation != seen; });
+				if (stop)
+				{
+					return;
+				}
+				seen = generation;
+			}
+			RunTasks(worker);
+		}
+	}
+};
+
+// 置換表
+// 盤面のハッシュ値をキーに，連鎖を解いた結果(得点・評価値・ゲームオーバー)を記録する
+// 大きさは固定で，複数のスレッドからロックなしで読み書きできる
+// キーとデータの排他的論理和を一緒に書くことで，書き込みが競合して壊れたエントリは読み出し時に捨てられる
+class PuyoTranspositionTable
+{
+public:
+	PuyoTranspositionTable() : entries(NULL), mask(0) {}
+
+	~PuyoTranspositionTable()
+	{
+		delete[] entries;
+	}
+
+	// 使用するメモリをmegabytes MB以下にする (エントリ数は2のべき乗)
+	void Resize(size_t megabytes)
+	{
+		size_t count = 1;
+		while (count * 2 * sizeof(Entry) <= megabytes * 1024 * 1024)
+		{
+			count *= 2;
+		}
+		delete[] entries;
+		entries = new Entry[count];
+		mask = count - 1;
+		Clear();
+	}
+
+	void Clear()
+	{
+		for (size_t i = 0; i <= mask && entries != NULL; i++)
+		{
+			entries[i].check.store(0, std::memory_order_relaxed);
+			entries[i].data.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	size_t GetSize() const
+	{
+		return entries == NULL ? 0 : (mask + 1) * sizeof(Entry);
+	}
+
+	bool Probe(uint64_t key, int &score, int &eval) const
+	{
+		if (entries == NULL)
+		{
+			return false;
+		}
+		const Entry &entry = entries[key & mask];
+		uint64_t data = entry.data.load(std::memory_order_relaxed);
+		uint64_t check = entry.check.load(std::memory_order_relaxed);
+		if ((check ^ data) != key)
+		{
+			return false;
+		}
+		score = (int32_t)(data >> 32);
+		eval = (int32_t)(data & 0xffffffffULL);
+		return true;
+	}
+
+	// 同じ位置のエントリは常に上書きする
+	void Store(uint64_t key, int score, int eval)
+	{
+		if (entries == NULL)
+		{
+			return;
+		}
+		Entry &entry = entries[key & mask];
+		uint64_t data = ((uint64_t)(uint32_t)score << 32) | (uint32_t)eval;
+		entry.check.store(key ^ data, std::memory_order_relaxed);
+		entry.data.store(data, std::memory_order_relaxed);
+	}
+
+private:
+	struct Entry
+	{
+		std::atomic<uint64_t> check;
+		std::atomic<uint64_t> data;
+	};
+
+	Entry *entries;
+	size_t mask;
+
+	PuyoTranspositionTable(const PuyoTranspositionTable &);
+	PuyoTranspositionTable &operator=(const PuyoTranspositionTable &);
+};
+
+// ロールアウトによる評価結果
+struct PuyoRolloutResult
+{
+	// 得点の期待値
+	double expectedScore;
+	// 連鎖数の平均
+	double averageChain;
+	// 全ロールアウト中の最大連鎖数
+	int maxChain;
+};
+
+class PuyoBot
+{
+public:
+	PuyoBot(int width = 64, int threads = 0) : pool(threads)
+	{
+		beamWidth = width;
+		threadNum = pool.GetThreadNum();
+		workers.resize(threadNum);
+		// ぷよの出現位置 (PuyoControl::GeneratePuyoと同じ)
+		spawnColumn = 5;
+		colorNum = 4;
+		rolloutNum = 0;
+		rolloutDepth = 8;
+		rolloutSeed = 0;
+		tableLine = 0;
+		tableColumn = 0;
+		table.Resize(DEFAULT_TABLE_SIZE);
+	}
+
+	int GetBeamWidth() const
+	{
+		return beamWidth;
+	}
+	void SetBeamWidth(int width)
+	{
+		beamWidth = width;
+	}
+
+	int GetThreadNum() const
+	{
+		return threadNum;
+	}
+
+	// ランダムなネクストの色数
+	void SetColorNum(int num)
+	{
+		colorNum = num;
+	}
+
+	// 1つの置き方あたりのロールアウト数 (0ならロールアウトしない)
+	int GetRolloutNum() const
+	{
+		return rolloutNum;
+	}
+	void SetRolloutNum(int num)
+	{
+		rolloutNum = num;
+	}
+
+	// ぷよの出現位置 (PuyoControl::GetSpawnColumnに合わせる)
+	// 置ける範囲とゲームオーバーの判定が変わるので，置換表は捨てる
+	void SetSpawnColumn(int column)
+	{
+		if (column != spawnColumn)
+		{
+			table.Clear();
+		}
+		spawnColumn = column;
+	}
+
+	// ロールアウトで置く組ぷよの数 (既知のネクストを含む)
+	void SetRolloutDepth(int depth)
+	{
+		rolloutDepth = depth;
+	}
+
+	void SetRolloutSeed(uint64_t seed)
+	{
+		rolloutSeed = seed;
+	}
+
+	// 置換表のメモリ上限 (MB)
+	void SetTableSize(size_t megabytes)
+	{
+		table.Resize(megabytes);
+	}
+	size_t GetTableSize() const
+	{
+		return table.GetSize();
+	}
+
+	// 組ぷよを置いたときの軸ぷよと子ぷよの位置を求める (PuyoPlacerの到達できる範囲のみ)
+	// 置けない場合はfalseを返す
+	bool Locate(const PuyoArrayStack &field, const PuyoPlacement &placement, PuyoLanding &landing) const
+	{
+		return PuyoPlacer::Locate(field, spawnColumn, placement, landing) && landing.axisY >= 0 && landing.childY >= 0;
+	}
+
+	// 組ぷよをfieldに置く
+	// 置けない場合はfalseを返し，fieldは変更しない
+	bool Place(PuyoArrayStack &field, const PuyoPair &pair, const PuyoPlacement &placement) const
+	{
+		PuyoLanding landing;
+		if (!Locate(field, placement, landing))
+		{
+			return false;
+		}
+		Drop(field, pair, landing);
+		return true;
+	}
+
+	// 組ぷよを置いた後の盤面のハッシュ値を，盤面を写さずに求める
+	bool PlacedHash(const PuyoArrayStack &field, const PuyoPair &pair, const PuyoPlacement &placement, uint64_t &hash) const
+	{
+		PuyoLanding landing;
+		if (!Locate(field, placement, landing))
+		{
+			return false;
+		}
+		hash = LandedHash(field, pair, landing);
+		return true;
+	}
+
+	// 出現位置がふさがっていればゲームオーバー
+	bool IsDead(const PuyoArrayStack &field) const
+	{
+		return field.GetTop(spawnColumn) == 0 || field.GetTop(spawnColumn + 1) == 0;
+	}
+
+	// 盤面の評価値 (大きいほど良い)
+	// 同じ色のぷよの隣接数を加点し，積み上がった列を減点する
+	static int Evaluate(const PuyoArrayStack &field)
+	{
+		const PuyoBitboard &board = field.GetBitboard();
+		unsigned int line = field.GetLine();
+		unsigned int column = field.GetColumn();
+		unsigned int words = board.GetWords();
+
+		int connection = 0;
+		for (int c = RED; c <= PURPLE; c++)
+		{
+			for (unsigned int y = 0; y < line; y++)
+			{
+				const uint64_t *row = board.GetRow(static_cast<puyocolor>(c), y);
+				const uint64_t *below = (y + 1 < line) ? board.GetRow(static_cast<puyocolor>(c), y + 1) : NULL;
+				for (unsigned int w = 0; w < words; w++)
+				{
+					uint64_t right = (row[w] >> 1) | (w + 1 < words ? row[w + 1] << 63 : 0);
+					connection += __builtin_popcountll(row[w] & right);
+					if (below != NULL)
+					{
+						connection += __builtin_popcountll(row[w] & below[w]);
+					}
+				}
+			}
+		}
+
+		int height = 0;
+		for (unsigned int x = 0; x < column; x++)
+		{
+			int h = field.GetHeight(x);
+			height += h * h;
+		}
+
+		return connection * 20 - height;
+	}
+
+	// 現在の組ぷよとネクストの組ぷよから，もっとも良い置き方を求める
+	// pairs[0]が現在の組ぷよ，pairs[1]以降がネクスト
+	// 置ける場所がなければrotationが-1の置き方を返す
+	PuyoPlacement Think(const PuyoArrayStack &stack, const std::vector<PuyoPair> &pairs)
+	{
+		// ハッシュ値はマスの番号 (y * column + x) から作るので，盤面の大きさが変わったら置換表は使えない
+		if (stack.GetLine() != tableLine || stack.GetColumn() != tableColumn)
+		{
+			table.Clear();
+			tableLine = stack.GetLine();
+			tableColumn = stack.GetColumn();
+		}
+
+		PuyoPlacement best;
+		best.column = 0;
+		best.rotation = -1;
+		PrepareWorkers(stack.GetColumn());
+
+		beam.assign(1, Node());
+		beam[0].field.Pack(stack);
+		beam[0].score = 0;
+		beam[0].first = best;
+
+		for (size_t depth = 0; depth < pairs.size(); depth++)
+		{
+			const PuyoPair &pair = pairs[depth];
+
+			// 各ノードの子を並列に評価する (盤面はワーカーごとに1つだけ使い回す)
+			// 置ける範囲はノードごとに1回だけ求め，止まる位置からハッシュ値と子の盤面を作る
+			for (int t = 0; t < threadNum; t++)
+			{
+				workers[t].found.clear();
+			}
+			pool.ParallelFor(beam.size(), [&](size_t i, int thread) {
+				Worker &worker = workers[thread];
+				beam[i].field.Unpack(worker.node);
+				unsigned int count = Landings(worker.node, pair, worker.landings.data());
+				for (unsigned int p = 0; p < count; p++)
+				{
+					// 連鎖の結果は盤面だけで決まるので，置換表にあれば連鎖の計算を省く
+					const PuyoLanding &landing = worker.landings[p];
+					uint64_t hash = LandedHash(worker.node, pair, landing);
+					int score, eval;
+					if (!table.Probe(hash, score, eval))
+					{
+						worker.scratch = worker.node;
+						Drop(worker.scratch, pair, landing);
+						worker.simulator.Resolve(worker.scratch, worker.result);
+						score = worker.result.score;
+						eval = IsDead(worker.scratch) ? DEAD : Evaluate(worker.scratch);
+						table.Store(hash, score, eval);
+					}
+					if (eval == DEAD)
+					{
+						continue;
+					}
+					Candidate candidate;
+					candidate.parent = i;
+					candidate.landing = landing;
+					candidate.hash = hash;
+					candidate.score = beam[i].score + score;
+					candidate.eval = candidate.score + eval;
+					candidate.first = (depth == 0) ? landing.placement : beam[i].first;
+					worker.found.push_back(candidate);
+				}
+			});
+
+			std::vector<Candidate> candidates;
+			for (int t = 0; t < threadNum; t++)
+			{
+				candidates.insert(candidates.end(), workers[t].found.begin(), workers[t].found.end());
+			}
+			if (candidates.empty())
+			{
+				break;
+			}
+
+			// 上位beamWidth個を残す (同点ならスレッド数によらず同じ順になるよう親と置き方で決める)
+			// 手順違いで同じ盤面になった子は，先に現れた1つだけを残す
+			std::sort(candidates.begin(), candidates.end(), CompareCandidate);
+			size_t keep = 0;
+			seen.clear();
+			for (size_t i = 0; i < candidates.size() && keep < (size_t)beamWidth; i++)
+			{
+				if (seen.insert(candidates[i].hash).second)
+				{
+					candidates[keep++] = candidates[i];
+				}
+			}
+			candidates.resize(keep);
+			best = candidates[0].first;
+
+			// 残した子の盤面を作り直す
+			std::vector<Node> next(keep);
+			pool.ParallelFor(keep, [&](size_t i, int thread) {
+				Worker &worker = workers[thread];
+				const Candidate &candidate = candidates[i];
+				beam[candidate.parent].field.Unpack(worker.node);
+				Drop(worker.node, pair, candidate.landing);
+				worker.simulator.Resolve(worker.node, worker.result);
+				next[i].field.Pack(worker.node);
+				next[i].score = candidate.score;
+				next[i].first = candidate.first;
+			});
+			beam.swap(next);
+		}
+
+		if (rolloutNum > 0 && best.rotation >= 0)
+		{
+			best = ChooseByRollout(stack, pairs);
+		}
+		return best;
+	}
+
+	// placementに置いた後をrolloutNum回ランダムに打ち進めて評価する
+	// pairs[0]をplacementに置き，残りの既知のネクスト，その後はランダムな組ぷよを
+	// 1手読みの貪欲法でrolloutDepth個目まで置く
+	// 各ロールアウトの乱数はシードとロールアウト番号だけで決まるので，結果はスレッド数によらない
+	PuyoRolloutResult EvaluateRollouts(const PuyoArrayStack &stack, const std::vector<PuyoPair> &pairs, const PuyoPlacement &placement)
+	{
+		PrepareWorkers(stack.GetColumn());
+		rollouts.resize(rolloutNum);
+		pool.ParallelFor(rolloutNum, [&](size_t i, int thread) {
+			Rollout(workers[thread], stack, pairs, placement, i, rollouts[i]);
+		});
+
+		// 足し合わせる順序も固定する
+		PuyoRolloutResult total;
+		total.expectedScore = 0;
+		total.averageChain = 0;
+		total.maxChain = 0;
+		for (int i = 0; i < rolloutNum; i++)
+		{
+			total.expectedScore += rollouts[i].score;
+			total.averageChain += rollouts[i].maxChain;
+			total.maxChain = std::max(total.maxChain, rollouts[i].maxChain);
+		}
+		if (rolloutNum > 0)
+		{
+			total.expectedScore /= rolloutNum;
+			total.averageChain /= rolloutNum;
+		}
+		return total;
+	}
+
+private:
+	// ビームに残す盤面は1マス3ビットに詰めて持ち，展開するときにワーカーの盤面に戻す
+	struct Node
+	{
+		PuyoPackedField field;
+		int score;
+		PuyoPlacement first;
+	};
+
+	struct Candidate
+	{
+		size_t parent;
+		PuyoLanding landing;
+		uint64_t hash;
+		int score;
+		int eval;
+		PuyoPlacement first;
+	};
+
+	// ワーカーごとの作業領域
+	struct Worker
+	{
+		PuyoChainSimulator simulator;
+		PuyoChainResult result;
+		PuyoArrayStack scratch;
+		PuyoArrayStack field;
+		// 展開中のビームの盤面
+		PuyoArrayStack node;
+		std::vector<Candidate> found;
+		// PuyoPlacer::Enumerateの結果 (PuyoPlacer::MaxCount(列数)個)
+		std::vector<PuyoLanding> landings;
+	};
+
+	// ロールアウト1回分の結果
+	struct RolloutOutcome
+	{
+		int score;
+		int maxChain;
+	};
+
+	// ロールアウトで再評価するビーム上位の初手の数
+	static const int ROLLOUT_CANDIDATES = 4;
+	// 置換表の既定の大きさ (MB)
+	static const size_t DEFAULT_TABLE_SIZE = 16;
+	// 置換表でゲームオーバーを表す評価値
+	static const int DEAD = INT32_MIN;
+
+	int beamWidth;
+	int threadNum;
+	int spawnColumn;
+	int colorNum;
+	int rolloutNum;
+	int rolloutDepth;
+	uint64_t rolloutSeed;
+	PuyoThreadPool pool;
+	std::vector<Worker> workers;
+	std::vector<Node> beam;
+	std::vector<RolloutOutcome> rollouts;
+	PuyoTranspositionTable table;
+	// 置換表の中身を求めた盤面の大きさ
+	unsigned int tableLine;
+	unsigned int tableColumn;
+	std::unordered_set<uint64_t> seen;
+
+	// ワーカーの置き方の一覧をcolumn列の盤面に合わせる
+	void PrepareWorkers(unsigned int column)
+	{
+		for (int t = 0; t < threadNum; t++)
+		{
+			workers[t].landings.resize(PuyoPlacer::MaxCount(column));
+		}
+	}
+
+	// fieldにpairを置けるすべての置き方の止まる位置をlandingsに書き，その数を返す
+	// 盤面の上にはみ出す置き方は除く (Locateと同じ)
+	unsigned int Landings(const PuyoArrayStack &field, const PuyoPair &pair, PuyoLanding *landings) const
+	{
+		unsigned int count = PuyoPlacer::Enumerate(field, pair, spawnColumn, landings);
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			if (landings[i].axisY >= 0 && landings[i].childY >= 0)
+			{
+				landings[kept++] = landings[i];
+			}
+		}
+		return kept;
+	}
+
+	// 止まる位置の分かった組ぷよをfieldに置く
+	static void Drop(PuyoArrayStack &field, const PuyoPair &pair, const PuyoLanding &landing)
+	{
+		field.SetValue(landing.axisY, landing.axisX, pair.axis);
+		field.SetValue(landing.childY, landing.childX, pair.child);
+	}
+
+	// 止まる位置の分かった組ぷよを置いた後の盤面のハッシュ値
+	static uint64_t LandedHash(const PuyoArrayStack &field, const PuyoPair &pair, const PuyoLanding &landing)
+	{
+		unsigned int column = field.GetColumn();
+		uint64_t hash = field.GetHash();
+		hash ^= PuyoZobrist::CellKey(landing.axisY * column + landing.axisX, pair.axis);
+		hash ^= PuyoZobrist::CellKey(landing.childY * column + landing.childX, pair.child);
+		return hash;
+	}
+
+	static bool SamePlacement(const PuyoPlacement &a, const PuyoPlacement &b)
+	{
+		return a.column == b.column && a.rotation == b.rotation;
+	}
+
+	// ビームの上位から異なる初手をいくつか選び，ロールアウトの期待値が最大のものを返す
+	PuyoPlacement ChooseByRollout(const PuyoArrayStack &stack, const std::vector<PuyoPair> &pairs)
+	{
+		std::vector<PuyoPlacement> firsts;
+		for (size_t i = 0; i < beam.size() && (int)firsts.size() < ROLLOUT_CANDIDATES; i++)
+		{
+			bool known = false;
+			for (size_t j = 0; j < firsts.size() && !known; j++)
+			{
+				known = SamePlacement(firsts[j], beam[i].first);
+			}
+			if (!known)
+			{
+				firsts.push_back(beam[i].first);
+			}
+		}
+
+		PuyoPlacement best = firsts[0];
+		double bestScore = -1;
+		for (size_t i = 0; i < firsts.size(); i++)
+		{
+			PuyoRolloutResult result = EvaluateRollouts(stack, pairs, firsts[i]);
+			if (result.expectedScore > bestScore)
+			{
+				bestScore = result.expectedScore;
+				best = firsts[i];
+			}
+		}
+		return best;
+	}
+
+	// ロールアウト番号indexの乱数の種
+	static uint64_t RolloutSeed(uint64_t seed, uint64_t index)
+	{
+		return PuyoMix64(seed + index * 0x9e3779b97f4a7c15ULL);
+	}
+
+	void Rollout(Worker &worker, const PuyoArrayStack &stack, const std::vector<PuyoPair> &pairs, const PuyoPlacement &placement, size_t index, RolloutOutcome &outcome)
+	{
+		PuyoRandom random(RolloutSeed(rolloutSeed, index));
+
+		outcome.score = 0;
+		outcome.maxChain = 0;
+		worker.field = stack;
+		if (!Place(worker.field, pairs[0], placement))
+		{
+			return;
+		}
+		worker.simulator.Resolve(worker.field, worker.result);
+		outcome.score += worker.result.score;
+		outcome.maxChain = worker.result.chain;
+
+		for (int depth = 1; depth < rolloutDepth && !IsDead(worker.field); depth++)
+		{
+			PuyoPair pair;
+			if (depth < (int)pairs.size())
+			{
+				pair = pairs[depth];
+			}
+			else
+			{
+				pair.axis = static_cast<puyocolor>(RED + random.Below(colorNum));
+				pair.child = static_cast<puyocolor>(RED + random.Below(colorNum));
+			}
+
+			// 1手読みでもっとも評価値の高い置き方を選ぶ
+			int bestEval = 0;
+			int bestIndex = -1;
+			unsigned int count = Landings(worker.field, pair, worker.landings.data());
+			for (unsigned int p = 0; p < count; p++)
+			{
+				worker.scratch = worker.field;
+				Drop(worker.scratch, pair, worker.landings[p]);
+				worker.simulator.Resolve(worker.scratch, worker.result);
+				if (IsDead(worker.scratch))
+				{
+					continue;
+				}
+				int eval = worker.result.score + Evaluate(worker.scratch);
+				if (bestIndex < 0 || eval > bestEval)
+				{
+					bestIndex = p;
+					bestEval = eval;
+				}
+			}
+			if (bestIndex < 0)
+			{
+				break;
+			}
+
+			Drop(worker.field, pair, worker.landings[bestIndex]);
+			worker.simulator.Resolve(worker.field, worker.result);
+			outcome.score += worker.result.score;
+			outcome.maxChain = std::max(outcome.maxChain, worker.result.chain);
+		}
+	}
+
+	static bool CompareCandidate(const Candidate &a, const Candidate &b)
+	{
+		if (a.eval != b.eval)
+		{
+			return a.eval > b.eval;
+		}
+		if (a.parent != b.parent)
+		{
+			return a.parent < b.parent;
+		}
+		if (a.landing.placement.column != b.landing.placement.column)
+		{
+			return a.landing.placement.column < b.landing.placement.column;
+		}
+		return a.landing.placement.rotation < b.landing.placement.rotation;
+	}
+};
+
+#endif
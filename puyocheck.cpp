@@ -0,0 +1,147 @@
+// puyocheck: checks PuyoPlacer against the engine, outside the game binary
+// g++ -std=c++17 -O2 puyocheck.cpp -o puyocheck
+// puyocheck [fields] [seed]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include "puyoengine.h"
+
+// Placements the engine itself lets a player reach: every key and gravity combination
+// through PuyoControl::Update, from the spawn position until the pair lands
+// Each placement is column * 4 + rotation
+void ReachByEngine(PuyoControl &control, const PuyoArrayStack &stack, const PuyoPair &pair, std::set<int> &placements)
+{
+	placements.clear();
+	if (control.IsSpawnBlocked(stack))
+	{
+		return;
+	}
+	std::vector<bool> seen(stack.GetLine() * stack.GetColumn() * 4, false);
+	std::vector<PuyoArrayActive> open(1);
+	open[0].ChangeSize(stack.GetLine(), stack.GetColumn());
+	open[0].SetPiece(0, control.GetSpawnColumn(), 0, pair);
+	while (!open.empty())
+	{
+		PuyoArrayActive active = open.back();
+		open.pop_back();
+		size_t state = (active.GetAxisY() * stack.GetColumn() + active.GetAxisX()) * 4 + active.GetPuyoRotate();
+		if (seen[state])
+		{
+			continue;
+		}
+		seen[state] = true;
+
+		PuyoArrayActive landing = active;
+		PuyoArrayStack landed = stack;
+		if (control.LandingPuyo(landing, landed))
+		{
+			placements.insert(active.GetAxisX() * 4 + active.GetPuyoRotate());
+			continue;
+		}
+		for (int input = INPUT_NONE; input <= INPUT_ROTATE; input++)
+		{
+			for (int gravity = 0; gravity < 2; gravity++)
+			{
+				PuyoArrayActive next = active;
+				PuyoArrayStack nextStack = stack;
+				control.Update(next, nextStack, static_cast<puyoinput>(input), gravity != 0);
+				if (next.IsFalling())
+				{
+					open.push_back(next);
+				}
+			}
+		}
+	}
+}
+
+// Check PuyoPlacer (Enumerate and Locate, and the fixed-size Enumerate on the standard field)
+// against the engine on random fields of random sizes
+// Returns 1 if any field gives a different set of placements
+int RunPlacerCheck(int fields, uint64_t seed)
+{
+	PuyoRandom random(seed);
+	int mismatches = 0;
+	for (int i = 0; i < fields; i++)
+	{
+		bool standard = random.Below(2) == 0;
+		unsigned int line = standard ? PuyoStandardField::LINE_NUMBER : 3 + random.Below(14);
+		unsigned int column = standard ? PuyoStandardField::COLUMN_NUMBER : 2 + random.Below(9);
+		PuyoArrayStack stack;
+		stack.ChangeSize(line, column);
+		// Columns of random heights, a third of them stacked close to the top
+		for (unsigned int x = 0; x < column; x++)
+		{
+			unsigned int height = (random.Below(3) == 0) ? line - std::min(line, random.Below(5)) : random.Below(line + 1);
+			for (unsigned int h = 0; h < height; h++)
+			{
+				stack.SetValue(line - 1 - h, x, static_cast<puyocolor>(RED + random.Below(4)));
+			}
+		}
+		PuyoControl control;
+		control.SetSpawnColumn(PuyoControl::SpawnColumnFor(column));
+		PuyoPair pair;
+		pair.axis = RED;
+		pair.child = BLUE;
+
+		std::set<int> engine;
+		ReachByEngine(control, stack, pair, engine);
+
+		std::vector<PuyoLanding> landings(PuyoPlacer::MaxCount(column));
+		unsigned int count = PuyoPlacer::Enumerate(stack, pair, control.GetSpawnColumn(), landings.data());
+		std::set<int> enumerated, located, fixed;
+		for (unsigned int n = 0; n < count; n++)
+		{
+			enumerated.insert(landings[n].placement.column * 4 + landings[n].placement.rotation);
+		}
+		for (int x = 0; x < (int)column; x++)
+		{
+			for (int r = 0; r < 4; r++)
+			{
+				PuyoPlacement placement;
+				placement.column = x;
+				placement.rotation = r;
+				PuyoLanding landing;
+				if (PuyoPlacer::Locate(stack, control.GetSpawnColumn(), placement, landing))
+				{
+					located.insert(x * 4 + r);
+				}
+			}
+		}
+		if (standard)
+		{
+			PuyoStandardField field;
+			field.Load(stack);
+			count = PuyoPlacer::Enumerate(field, pair, control.GetSpawnColumn(), landings.data());
+			for (unsigned int n = 0; n < count; n++)
+			{
+				fixed.insert(landings[n].placement.column * 4 + landings[n].placement.rotation);
+			}
+		}
+
+		if (enumerated != engine || located != engine || (standard && fixed != engine))
+		{
+			if (mismatches < 10)
+			{
+				printf("field %u x %u, tops", line, column);
+				for (unsigned int x = 0; x < column; x++)
+				{
+					printf(" %u", stack.GetTop(x));
+				}
+				printf(": engine %zu, Enumerate %zu, Locate %zu\n", engine.size(), enumerated.size(), located.size());
+			}
+			mismatches++;
+		}
+	}
+	printf("%d fields, %d mismatches\n", fields, mismatches);
+	return (mismatches > 0) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int fields = (argc >= 2) ? atoi(argv[1]) : 10000;
+	uint64_t seed = (argc >= 3) ? strtoull(argv[2], NULL, 10) : 1;
+	return RunPlacerCheck(fields, seed);
+}
@@ -0,0 +1,2255 @@
+#ifndef PUYOENGINE_H
+#define PUYOENGINE_H
+
+// ぷよぷよのゲームルール (盤面・操作・消滅・得点計算)
+// 画面表示(curses)に依存しないので，表示なしのシミュレーションからも利用できる
+
+#include <cstdlib>
+#include <ctime>
+#include <cstdint>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+class PuyoArray;
+class PuyoArrayActive;
+class PuyoArrayStack;
+class PuyoControl;
+
+// ぷよの色を表すの列挙型
+// NONEが無し，RED,BLUE,..が色を表す
+enum puyocolor
+{
+	NONE,
+	RED,
+	BLUE,
+	GREEN,
+	YELLOW,
+	PURPLE
+};
+
+// 盤面の1マス (puyocolorの値を1バイトで持つ)
+typedef uint8_t puyocell;
+
+// 64bitの値をよく混ぜる (splitmix64)
+inline uint64_t PuyoMix64(uint64_t z)
+{
+	z += 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// 擬似乱数生成器 (xoshiro256**)
+// インスタンスごとに状態を持つので，スレッドやリプレイごとに独立した乱数列を使える
+class PuyoRandom
+{
+public:
+	PuyoRandom(uint64_t seed = 0)
+	{
+		Seed(seed);
+	}
+
+	// 種をsplitmix64で4語の状態に広げる
+	void Seed(uint64_t seed)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			state[i] = PuyoMix64(seed + i * 0x9e3779b97f4a7c15ULL);
+		}
+	}
+
+	uint64_t Next()
+	{
+		uint64_t result = Rotl(state[1] * 5, 7) * 9;
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = Rotl(state[3], 45);
+		return result;
+	}
+
+	// 0以上n未満の一様な整数
+	// 剰余の偏りが出ないよう，2^64をnで割った余りの分だけ捨てる
+	unsigned int Below(unsigned int n)
+	{
+		uint64_t threshold = (0 - (uint64_t)n) % n;
+		while (1)
+		{
+			uint64_t value = Next();
+			if (value >= threshold)
+			{
+				return value % n;
+			}
+		}
+	}
+
+private:
+	uint64_t state[4];
+
+	static uint64_t Rotl(uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+};
+
+// Zobristハッシュのキー
+// 盤面の大きさが実行時に決まるので，表を持たずに座標と色から擬似乱数を求める
+struct PuyoZobrist
+{
+	// 盤面のindex番目(y * 列数 + x)のセルに色colorのぷよがあることを表すキー
+	static uint64_t CellKey(unsigned int index, puyocolor color)
+	{
+		return PuyoMix64((uint64_t)index * 8 + color);
+	}
+
+	// ネクストのslot番目の位置に色colorのぷよがあることを表すキー
+	static uint64_t NextKey(unsigned int slot, puyocolor color)
+	{
+		return PuyoMix64(~((uint64_t)slot * 8 + color));
+	}
+};
+
+// 色ごとの占有ビットマスク
+// 1行を GetWords() 個の64bitワードで表し，x列目がビットxに対応する
+// NONE の位置には全色の和(占有マスク)を格納する
+class PuyoBitboard
+{
+public:
+	PuyoBitboard() : masks(NULL), board_line(0), board_column(0), board_words(0) {}
+
+	PuyoBitboard(const PuyoBitboard &other) : masks(NULL), board_line(0), board_column(0), board_words(0)
+	{
+		*this = other;
+	}
+
+	~PuyoBitboard()
+	{
+		Release();
+	}
+
+	PuyoBitboard &operator=(const PuyoBitboard &other)
+	{
+		if (this == &other)
+		{
+			return *this;
+		}
+		// 同じ大きさなら確保し直さずに中身だけ写す
+		if (board_line != other.board_line || board_column != other.board_column)
+		{
+			ChangeSize(other.board_line, other.board_column);
+		}
+		if (masks != NULL)
+		{
+			memcpy(masks, other.masks, sizeof(uint64_t) * MASK_NUMBER * board_line * board_words);
+		}
+		return *this;
+	}
+
+	void ChangeSize(unsigned int line, unsigned int column)
+	{
+		Release();
+		board_line = line;
+		board_column = column;
+		board_words = (column + 63) / 64;
+		masks = new uint64_t[MASK_NUMBER * line * board_words]();
+	}
+
+	unsigned int GetWords() const
+	{
+		return board_words;
+	}
+
+	// 色colorの行yのマスク (colorがNONEなら占有マスク)
+	const uint64_t *GetRow(puyocolor color, unsigned int y) const
+	{
+		return masks + (color * board_line + y) * board_words;
+	}
+
+	bool Test(puyocolor color, unsigned int y, unsigned int x) const
+	{
+		return (GetRow(color, y)[x / 64] >> (x % 64)) & 1;
+	}
+
+	void Set(puyocolor color, unsigned int y, unsigned int x)
+	{
+		uint64_t bit = (uint64_t)1 << (x % 64);
+		Row(color, y)[x / 64] |= bit;
+		Row(NONE, y)[x / 64] |= bit;
+	}
+
+	void Clear(puyocolor color, unsigned int y, unsigned int x)
+	{
+		uint64_t bit = (uint64_t)1 << (x % 64);
+		Row(color, y)[x / 64] &= ~bit;
+		Row(NONE, y)[x / 64] &= ~bit;
+	}
+
+	// 色colorのぷよの数 (colorがNONEなら全ぷよの数)
+	int Count(puyocolor color) const
+	{
+		int count = 0;
+		const uint64_t *row = GetRow(color, 0);
+		for (unsigned int i = 0; i < board_line * board_words; i++)
+		{
+			count += __builtin_popcountll(row[i]);
+		}
+		return count;
+	}
+
+	// 行yの色colorのぷよのうち，上下左右に同じ色のぷよが隣接するものをoutに書き出す
+	void ConnectedRow(puyocolor color, unsigned int y, uint64_t *out) const
+	{
+		const uint64_t *row = GetRow(color, y);
+		const uint64_t *up = (y > 0) ? GetRow(color, y - 1) : NULL;
+		const uint64_t *down = (y + 1 < board_line) ? GetRow(color, y + 1) : NULL;
+		for (unsigned int w = 0; w < board_words; w++)
+		{
+			// 左隣(x-1)と右隣(x+1)はワード境界をまたいでシフトする
+			uint64_t left = (row[w] << 1) | (w > 0 ? row[w - 1] >> 63 : 0);
+			uint64_t right = (row[w] >> 1) | (w + 1 < board_words ? row[w + 1] << 63 : 0);
+			uint64_t vertical = (up ? up[w] : 0) | (down ? down[w] : 0);
+			out[w] = row[w] & (left | right | vertical);
+		}
+	}
+
+private:
+	static const unsigned int MASK_NUMBER = PURPLE + 1;
+
+	uint64_t *masks;
+	unsigned int board_line;
+	unsigned int board_column;
+	unsigned int board_words;
+
+	uint64_t *Row(puyocolor color, unsigned int y)
+	{
+		return masks + (color * board_line + y) * board_words;
+	}
+
+	void Release()
+	{
+		if (masks == NULL)
+		{
+			return;
+		}
+		delete[] masks;
+		masks = NULL;
+	}
+};
+
+// 落下中ぷよへの操作
+enum puyoinput
+{
+	INPUT_NONE,
+	INPUT_LEFT,
+	INPUT_RIGHT,
+	INPUT_DOWN,
+	INPUT_ROTATE
+};
+
+class PuyoArray
+{
+public:
+	PuyoArray() : data(NULL), tops(NULL), counts(NULL), data_line(0), data_column(0), colorCounts(), hash(0) {}
+
+	PuyoArray(const PuyoArray &other) : data(NULL), tops(NULL), counts(NULL), data_line(0), data_column(0), colorCounts(), hash(0)
+	{
+		*this = other;
+	}
+
+	~PuyoArray()
+	{
+		Release();
+	}
+
+	PuyoArray &operator=(const PuyoArray &other)
+	{
+		if (this == &other)
+		{
+			return *this;
+		}
+		// 同じ大きさなら確保し直さずに中身だけ写す
+		if (data_line != other.data_line || data_column != other.data_column)
+		{
+			ChangeSize(other.data_line, other.data_column);
+		}
+		if (data != NULL)
+		{
+			memcpy(data, other.data, sizeof(puyocell) * data_line * data_column);
+			memcpy(tops, other.tops, sizeof(unsigned int) * data_column);
+			memcpy(counts, other.counts, sizeof(unsigned int) * data_column);
+		}
+		bitboard = other.bitboard;
+		memcpy(colorCounts, other.colorCounts, sizeof(colorCounts));
+		hash = other.hash;
+		return *this;
+	}
+
+	void ChangeSize(unsigned int line, unsigned int column)
+	{
+		Release();
+		data = new puyocell[line * column]();
+		tops = new unsigned int[column];
+		counts = new unsigned int[column]();
+		for (unsigned int x = 0; x < column; x++)
+		{
+			tops[x] = line;
+		}
+		data_line = line;
+		data_column = column;
+		bitboard.ChangeSize(line, column);
+		memset(colorCounts, 0, sizeof(colorCounts));
+		hash = 0;
+	}
+
+	unsigned int GetLine() const
+	{
+		return data_line;
+	}
+
+	unsigned int GetColumn() const
+	{
+		return data_column;
+	}
+
+	puyocolor GetValue(unsigned int y, unsigned int x) const
+	{
+		if (y >= GetLine() || x >= GetColumn())
+		{
+			// 引数の値が正しくない
+			return NONE;
+		}
+		return static_cast<puyocolor>(data[y * GetColumn() + x]);
+	}
+
+	void SetValue(unsigned int y, unsigned int x, puyocolor puyodata)
+	{
+		if (y >= GetLine() || x >= GetColumn())
+		{
+			// 引数の値が正しくない
+			return;
+		}
+		unsigned int index = y * GetColumn() + x;
+		puyocolor cell = static_cast<puyocolor>(data[index]);
+		if (cell == puyodata)
+		{
+			return;
+		}
+		// ビットマスクとハッシュ値も同時に更新する
+		if (cell != NONE)
+		{
+			bitboard.Clear(cell, y, x);
+			hash ^= PuyoZobrist::CellKey(index, cell);
+			counts[x]--;
+			colorCounts[cell]--;
+			colorCounts[NONE]--;
+		}
+		if (puyodata != NONE)
+		{
+			bitboard.Set(puyodata, y, x);
+			hash ^= PuyoZobrist::CellKey(index, puyodata);
+			counts[x]++;
+			colorCounts[puyodata]++;
+			colorCounts[NONE]++;
+			if (y < tops[x])
+			{
+				tops[x] = y;
+			}
+		}
+		data[index] = puyodata;
+
+		// 列のいちばん上のぷよを消したら，その下で次のぷよを探す
+		if (puyodata == NONE && y == tops[x])
+		{
+			unsigned int top = y + 1;
+			while (counts[x] > 0 && top < data_line && data[top * data_column + x] == NONE)
+			{
+				top++;
+			}
+			tops[x] = (counts[x] > 0) ? top : data_line;
+		}
+	}
+
+	// ぷよの数 (SetValueのたびに数え直しているので盤面を調べない)
+	int CountPuyo() const
+	{
+		return colorCounts[NONE];
+	}
+
+	// 色colorのぷよの数 (colorがNONEなら全ぷよの数)
+	int GetColorCount(puyocolor color) const
+	{
+		return colorCounts[color];
+	}
+
+	// x列でいちばん上にあるぷよの行 (空の列ならGetLine())
+	// 列ごとにSetValueのたびに更新しているので，盤面を調べずに返す
+	int GetTop(unsigned int x) const
+	{
+		return tops[x];
+	}
+
+	// x列の高さ (最下段からいちばん上のぷよまで，途中の空きも含む)
+	int GetHeight(unsigned int x) const
+	{
+		return data_line - tops[x];
+	}
+
+	// x列にあるぷよの数
+	int GetColumnCount(unsigned int x) const
+	{
+		return counts[x];
+	}
+
+	// x列が下に詰まっているか (浮いたぷよがない)
+	bool IsSettled(unsigned int x) const
+	{
+		return tops[x] + counts[x] == data_line;
+	}
+
+	const PuyoBitboard &GetBitboard() const
+	{
+		return bitboard;
+	}
+
+	// 全マスの色 (行優先，GetLine() * GetColumn()個)
+	const puyocell *GetCells() const
+	{
+		return data;
+	}
+
+	// 盤面のZobristハッシュ値 (SetValueのたびに差分で更新される)
+	uint64_t GetHash() const
+	{
+		return hash;
+	}
+
+private:
+	puyocell *data;
+	// 列ごとのいちばん上のぷよの行とぷよの数
+	unsigned int *tops;
+	unsigned int *counts;
+	unsigned int data_line;
+	unsigned int data_column;
+	PuyoBitboard bitboard;
+	// 色ごとのぷよの数 (NONEの位置は全ぷよの数)
+	int colorCounts[PURPLE + 1];
+	uint64_t hash;
+
+	void Release()
+	{
+		if (data == NULL)
+		{
+			return;
+		}
+		delete[] data;
+		delete[] tops;
+		delete[] counts;
+		data = NULL;
+		tops = NULL;
+		counts = NULL;
+	}
+};
+
+// 組ぷよ (軸ぷよと子ぷよ)
+struct PuyoPair
+{
+	puyocolor axis;
+	puyocolor child;
+};
+
+// 落下中の組ぷよとネクスト
+// 落下中の組ぷよは盤面全体ではなく，軸ぷよの位置と回転と2つの色で持つ
+// 回転は子ぷよの向きで，0: 右，1: 下，2: 左，3: 上
+class PuyoArrayActive
+{
+private:
+	unsigned int data_line;
+	unsigned int data_column;
+	// 落下中の組ぷよがあるか
+	bool falling;
+	int axisY;
+	int axisX;
+	int puyorotate;
+	PuyoPair pair;
+	// ネクスト3組分
+	puyocell nextpuyo[3 * 2];
+	uint64_t nexthash;
+
+public:
+	// 回転ごとの，軸ぷよから見た子ぷよの位置
+	static constexpr int CHILD_Y[4] = {0, 1, 0, -1};
+	static constexpr int CHILD_X[4] = {1, 0, -1, 0};
+
+	PuyoArrayActive()
+	{
+		data_line = 0;
+		data_column = 0;
+		falling = false;
+		axisY = 0;
+		axisX = 0;
+		puyorotate = 0;
+		pair.axis = NONE;
+		pair.child = NONE;
+		memset(nextpuyo, NONE, sizeof(nextpuyo));
+		nexthash = 0;
+	}
+
+	// 盤面の大きさを変える (落下中の組ぷよは消える)
+	void ChangeSize(unsigned int line, unsigned int column)
+	{
+		data_line = line;
+		data_column = column;
+		falling = false;
+	}
+
+	unsigned int GetLine() const
+	{
+		return data_line;
+	}
+
+	unsigned int GetColumn() const
+	{
+		return data_column;
+	}
+
+	// (y, x)にある落下中のぷよの色 (無ければNONE)
+	puyocolor GetValue(unsigned int y, unsigned int x) const
+	{
+		if (!falling)
+		{
+			return NONE;
+		}
+		if ((int)y == axisY && (int)x == axisX)
+		{
+			return pair.axis;
+		}
+		if ((int)y == GetChildY() && (int)x == GetChildX())
+		{
+			return pair.child;
+		}
+		return NONE;
+	}
+
+	int CountPuyo() const
+	{
+		return falling ? 2 : 0;
+	}
+
+	bool IsFalling() const
+	{
+		return falling;
+	}
+
+	// 軸ぷよを(y, x)に置き，回転rotateで組ぷよを出す
+	void SetPiece(int y, int x, int rotate, const PuyoPair &colors)
+	{
+		falling = true;
+		axisY = y;
+		axisX = x;
+		puyorotate = rotate & 3;
+		pair = colors;
+	}
+
+	void ClearPiece()
+	{
+		falling = false;
+	}
+
+	// 組ぷよを(dy, dx)だけ動かす
+	void MovePiece(int dy, int dx)
+	{
+		axisY += dy;
+		axisX += dx;
+	}
+
+	const PuyoPair &GetPair() const
+	{
+		return pair;
+	}
+	int GetAxisY() const
+	{
+		return axisY;
+	}
+	int GetAxisX() const
+	{
+		return axisX;
+	}
+	int GetChildY() const
+	{
+		return axisY + CHILD_Y[puyorotate];
+	}
+	int GetChildX() const
+	{
+		return axisX + CHILD_X[puyorotate];
+	}
+
+	int GetPuyoRotate() const
+	{
+		return puyorotate;
+	}
+	void SetPuyoRate(int rotate)
+	{
+		puyorotate = rotate & 3;
+	}
+
+	puyocolor GetNextPuyoValue(unsigned int y, unsigned int x)
+	{
+		if (y >= 3 || x >= 2)
+		{
+			// 引数の値が正しくない
+			return NONE;
+		}
+		return static_cast<puyocolor>(nextpuyo[y * 2 + x]);
+	}
+
+	void SetNextPuyoValue(unsigned int y, unsigned int x, puyocolor puyodata)
+	{
+		if (y >= 3 || x >= 2)
+		{
+			// 引数の値が正しくない
+			return;
+		}
+		// ハッシュ値も差分で更新する
+		unsigned int slot = y * 2 + x;
+		nexthash ^= PuyoZobrist::NextKey(slot, static_cast<puyocolor>(nextpuyo[slot])) ^ PuyoZobrist::NextKey(slot, puyodata);
+		nextpuyo[slot] = puyodata;
+	}
+
+	// ネクスト(出現待ちの組ぷよ)のZobristハッシュ値
+	// 盤面のGetHash()と排他的論理和をとれば，盤面と出現待ちの組ぷよを合わせた状態のハッシュ値になる
+	uint64_t GetNextHash() const
+	{
+		return nexthash;
+	}
+};
+
+class PuyoArrayStack : public PuyoArray
+{
+private:
+	int score;
+	int nowscore;
+
+public:
+	PuyoArrayStack()
+	{
+		score = 0;
+		nowscore = 0;
+	}
+	int GetScore() const
+	{
+		return score;
+	}
+	void AddScore(int num)
+	{
+		score += num;
+	}
+	void SetScore(int num)
+	{
+		score = num;
+	}
+
+	int GetNowscore() const
+	{
+		return nowscore;
+	}
+	void SetNowScore(int num)
+	{
+		nowscore = num;
+	}
+};
+
+// 1マス3ビットに詰めた盤面 (スナップショットや保存用)
+// 1語に21マスずつ入れ，マスが語をまたがないようにして読み書きを簡単にする
+class PuyoPackedField
+{
+public:
+	PuyoPackedField() : line(0), column(0) {}
+
+	explicit PuyoPackedField(const PuyoArray &field) : line(0), column(0)
+	{
+		Pack(field);
+	}
+
+	unsigned int GetLine() const
+	{
+		return line;
+	}
+
+	unsigned int GetColumn() const
+	{
+		return column;
+	}
+
+	// 詰めた盤面の大きさ (バイト)
+	size_t GetByteSize() const
+	{
+		return words.size() * sizeof(uint64_t);
+	}
+
+	puyocolor GetValue(unsigned int y, unsigned int x) const
+	{
+		if (y >= line || x >= column)
+		{
+			// 引数の値が正しくない
+			return NONE;
+		}
+		size_t index = y * column + x;
+		return static_cast<puyocolor>((words[index / CELLS_PER_WORD] >> (index % CELLS_PER_WORD * CELL_BITS)) & CELL_MASK);
+	}
+
+	void Pack(const PuyoArray &field)
+	{
+		Pack(field.GetCells(), field.GetLine(), field.GetColumn());
+	}
+
+	// 行優先に並んだline * column個のマスを詰める
+	void Pack(const puyocell *cells, unsigned int lineNum, unsigned int columnNum)
+	{
+		line = lineNum;
+		column = columnNum;
+		size_t count = line * column;
+		words.assign((count + CELLS_PER_WORD - 1) / CELLS_PER_WORD, 0);
+		for (size_t w = 0, index = 0; w < words.size(); w++)
+		{
+			uint64_t word = 0;
+			for (unsigned int shift = 0; shift < CELLS_PER_WORD * CELL_BITS && index < count; shift += CELL_BITS, index++)
+			{
+				word |= (uint64_t)cells[index] << shift;
+			}
+			words[w] = word;
+		}
+	}
+
+	// 行優先にline * column個のマスを書き出す
+	void Unpack(puyocell *cells) const
+	{
+		size_t count = line * column;
+		for (size_t w = 0, index = 0; w < words.size(); w++)
+		{
+			uint64_t word = words[w];
+			for (unsigned int n = 0; n < CELLS_PER_WORD && index < count; n++, index++)
+			{
+				cells[index] = word & CELL_MASK;
+				word >>= CELL_BITS;
+			}
+		}
+	}
+
+	// fieldに書き戻す (同じ大きさなら変わったマスだけ書き換える)
+	void Unpack(PuyoArray &field) const
+	{
+		if (field.GetLine() != line || field.GetColumn() != column)
+		{
+			field.ChangeSize(line, column);
+		}
+		const puyocell *cells = field.GetCells();
+		unsigned int y = 0, x = 0;
+		size_t index = 0;
+		for (size_t w = 0; w < words.size(); w++)
+		{
+			uint64_t word = words[w];
+			for (unsigned int n = 0; n < CELLS_PER_WORD && index < line * column; n++, index++)
+			{
+				puyocell cell = word & CELL_MASK;
+				word >>= CELL_BITS;
+				if (cells[index] != cell)
+				{
+					field.SetValue(y, x, static_cast<puyocolor>(cell));
+				}
+				if (++x == column)
+				{
+					x = 0;
+					y++;
+				}
+			}
+		}
+	}
+
+	bool operator==(const PuyoPackedField &other) const
+	{
+		return line == other.line && column == other.column && words == other.words;
+	}
+
+private:
+	static const unsigned int CELL_BITS = 3;
+	static const unsigned int CELLS_PER_WORD = 64 / CELL_BITS;
+	static const uint64_t CELL_MASK = (1 << CELL_BITS) - 1;
+
+	unsigned int line;
+	unsigned int column;
+	std::vector<uint64_t> words;
+};
+
+// これから出てくる組ぷよの待ち行列
+// 大きさが2のべき乗のリングバッファで，足りなくなったら倍に広げる
+class PuyoPairQueue
+{
+public:
+	PuyoPairQueue() : pairs(8), head(0), count(0) {}
+
+	void Clear()
+	{
+		head = 0;
+		count = 0;
+	}
+
+	size_t GetCount() const
+	{
+		return count;
+	}
+
+	// 先頭からindex番目の組ぷよ
+	const PuyoPair &Peek(size_t index) const
+	{
+		return pairs[(head + index) & (pairs.size() - 1)];
+	}
+
+	void Push(const PuyoPair &pair)
+	{
+		if (count == pairs.size())
+		{
+			Grow();
+		}
+		pairs[(head + count) & (pairs.size() - 1)] = pair;
+		count++;
+	}
+
+	PuyoPair Pop()
+	{
+		PuyoPair pair = pairs[head];
+		head = (head + 1) & (pairs.size() - 1);
+		count--;
+		return pair;
+	}
+
+private:
+	std::vector<PuyoPair> pairs;
+	size_t head;
+	size_t count;
+
+	void Grow()
+	{
+		std::vector<PuyoPair> grown(pairs.size() * 2);
+		for (size_t i = 0; i < count; i++)
+		{
+			grown[i] = Peek(i);
+		}
+		pairs.swap(grown);
+		head = 0;
+	}
+};
+
+// 消滅するぷよのグループ
+struct PuyoGroup
+{
+	puyocolor color;
+	int size;
+};
+
+// 重力で落下したぷよ
+// x列目のfrom行目からto行目へ移動した
+struct PuyoFall
+{
+	unsigned int x;
+	unsigned int from;
+	unsigned int to;
+	puyocolor color;
+};
+
+// 盤面の変化を表示側へ通知するためのインターフェース
+// エンジン自体は画面表示や待ち時間を持たず，演出はすべてこの通知を受けた側が行う
+class PuyoControlListener
+{
+public:
+	virtual ~PuyoControlListener() {}
+
+	// ぷよが消滅した (盤面からは消去済み)
+	// cellsには消滅した座標(y * 列数 + x)がgroupsの順に並ぶ
+	virtual void OnVanish(PuyoArrayActive &active, PuyoArrayStack &stack, const std::vector<PuyoGroup> &groups, const std::vector<unsigned int> &cells) {}
+	// 浮いたぷよが落下した (盤面は落下後の状態)
+	virtual void OnFall(PuyoArrayActive &active, PuyoArrayStack &stack, const std::vector<PuyoFall> &falls) {}
+	// 得点が加算された
+	virtual void OnScore(PuyoArrayActive &active, PuyoArrayStack &stack) {}
+	// 連鎖なしで着地した
+	virtual void OnScoreClear() {}
+};
+
+// 連鎖1回分の結果
+struct PuyoChainStep
+{
+	// 消えたぷよの数
+	int vanished;
+	// 消えた色の集合 (1 << puyocolor の論理和)
+	int colors;
+	int chainBonus;
+	int connectionBonus;
+	int colorBonus;
+	int score;
+	std::vector<PuyoGroup> groups;
+};
+
+// 連鎖全体の結果
+struct PuyoChainResult
+{
+	int chain;
+	int score;
+	bool allClear;
+	std::vector<PuyoChainStep> steps;
+	// 連鎖が終わった後の盤面
+	PuyoArrayStack field;
+};
+
+// 大きさがコンパイル時に決まる盤面
+// 行数と列数が定数なので，添字の計算やループ，ビットマスクが定数に畳み込まれる
+// 色ごとに列単位の32bitマスク(ビットyがy行目)を持ち，落下と連結の判定をビット演算で行う
+// 大きさが実行時に決まる盤面はPuyoArrayを使う
+template <unsigned int LINE, unsigned int COLUMN>
+class PuyoFixedField
+{
+public:
+	static_assert(LINE >= 1 && LINE <= 32, "a column must fit in 32 bits");
+	static_assert(COLUMN >= 1, "the field needs a column");
+	static const unsigned int LINE_NUMBER = LINE;
+	static const unsigned int COLUMN_NUMBER = COLUMN;
+
+	PuyoFixedField()
+	{
+		Clear();
+	}
+
+	static constexpr unsigned int GetLine()
+	{
+		return LINE;
+	}
+	static constexpr unsigned int GetColumn()
+	{
+		return COLUMN;
+	}
+
+	void Clear()
+	{
+		memset(cells, 0, sizeof(cells));
+		memset(masks, 0, sizeof(masks));
+	}
+
+	puyocolor GetValue(unsigned int y, unsigned int x) const
+	{
+		return static_cast<puyocolor>(cells[y * COLUMN + x]);
+	}
+
+	void SetValue(unsigned int y, unsigned int x, puyocolor value)
+	{
+		puyocell old = cells[y * COLUMN + x];
+		uint32_t bit = 1u << y;
+		if (old != NONE)
+		{
+			masks[old][x] &= ~bit;
+			masks[NONE][x] &= ~bit;
+		}
+		if (value != NONE)
+		{
+			masks[value][x] |= bit;
+			masks[NONE][x] |= bit;
+		}
+		cells[y * COLUMN + x] = value;
+	}
+
+	int CountPuyo() const
+	{
+		int count = 0;
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			count += __builtin_popcount(masks[NONE][x]);
+		}
+		return count;
+	}
+
+	// x列でいちばん上にあるぷよの行 (空の列ならLINE)
+	int GetTop(unsigned int x) const
+	{
+		return (masks[NONE][x] == 0) ? LINE : __builtin_ctz(masks[NONE][x]);
+	}
+
+	// 同じ大きさの盤面から読み込む (大きさが違えばfalse)
+	// マスは同じ並びなのでそのまま写し，マスクだけ作る
+	bool Load(const PuyoArray &array)
+	{
+		if (array.GetLine() != LINE || array.GetColumn() != COLUMN)
+		{
+			return false;
+		}
+		memcpy(cells, array.GetCells(), sizeof(cells));
+		memset(masks, 0, sizeof(masks));
+		for (unsigned int y = 0; y < LINE; y++)
+		{
+			for (unsigned int x = 0; x < COLUMN; x++)
+			{
+				masks[cells[y * COLUMN + x]][x] |= 1u << y;
+			}
+		}
+		// NONEの欄には空きマスが集まるので，反転して占有マスクにする
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			masks[NONE][x] = FULL & ~masks[NONE][x];
+		}
+		return true;
+	}
+
+	// 同じ大きさの盤面に書き戻す (変わったセルだけ書く)
+	void Store(PuyoArray &array) const
+	{
+		const puyocell *current = array.GetCells();
+		for (unsigned int i = 0; i < LINE * COLUMN; i++)
+		{
+			if (current[i] != cells[i])
+			{
+				array.SetValue(i / COLUMN, i % COLUMN, static_cast<puyocolor>(cells[i]));
+			}
+		}
+	}
+
+	// 浮いたぷよを下に詰める
+	// 下詰めになっている列は占有マスクだけで判定して飛ばす
+	bool ApplyGravity()
+	{
+		bool moved = false;
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			uint32_t occupied = masks[NONE][x];
+			int count = __builtin_popcount(occupied);
+			if (occupied == (FULL & ~(uint32_t)((1ULL << (LINE - count)) - 1)))
+			{
+				continue;
+			}
+			moved = true;
+			int bottom = LINE - 1;
+			for (int y = LINE - 1; y >= 0; y--)
+			{
+				puyocolor color = static_cast<puyocolor>(cells[y * COLUMN + x]);
+				if (color == NONE)
+				{
+					continue;
+				}
+				if (y != bottom)
+				{
+					SetValue(bottom, x, color);
+					SetValue(y, x, NONE);
+				}
+				bottom--;
+			}
+		}
+		return moved;
+	}
+
+	// 4個以上連結したぷよのグループを求める
+	// groupsに各グループの色と個数を，vanishに消えるぷよのマスクを列ごとに格納する
+	// 1個のぷよから始めて，同じ色のマスクの中で上下左右に広げられなくなるまで広げる
+	void FindVanishGroups(std::vector<PuyoGroup> &groups, uint32_t vanish[COLUMN]) const
+	{
+		groups.clear();
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			vanish[x] = 0;
+		}
+		for (int c = RED; c <= PURPLE; c++)
+		{
+			// 上下左右に同じ色のぷよがあるものだけを残す (孤立したぷよは起点にも経路にもならない)
+			uint32_t remaining[COLUMN];
+			int total = 0;
+			for (unsigned int x = 0; x < COLUMN; x++)
+			{
+				uint32_t mask = masks[c][x];
+				uint32_t neighbor = (mask << 1) | (mask >> 1);
+				if (x > 0)
+				{
+					neighbor |= masks[c][x - 1];
+				}
+				if (x + 1 < COLUMN)
+				{
+					neighbor |= masks[c][x + 1];
+				}
+				remaining[x] = mask & neighbor;
+				total += __builtin_popcount(remaining[x]);
+			}
+			if (total < 4)
+			{
+				continue;
+			}
+
+			for (unsigned int start = 0; start < COLUMN; start++)
+			{
+				while (remaining[start] != 0)
+				{
+					uint32_t group[COLUMN] = {0};
+					group[start] = remaining[start] & (0u - remaining[start]);
+					// グループが広がった列の範囲[left, right]とその両隣だけを見る
+					unsigned int left = start;
+					unsigned int right = start;
+					bool grown = true;
+					while (grown)
+					{
+						grown = false;
+						unsigned int from = (left > 0) ? left - 1 : 0;
+						unsigned int to = (right + 1 < COLUMN) ? right + 1 : right;
+						for (unsigned int x = from; x <= to; x++)
+						{
+							uint32_t spread = group[x] | (group[x] << 1) | (group[x] >> 1);
+							if (x > 0)
+							{
+								spread |= group[x - 1];
+							}
+							if (x + 1 < COLUMN)
+							{
+								spread |= group[x + 1];
+							}
+							spread &= remaining[x];
+							if (spread != group[x])
+							{
+								group[x] = spread;
+								grown = true;
+								left = std::min(left, x);
+								right = std::max(right, x);
+							}
+						}
+					}
+
+					int size = 0;
+					for (unsigned int x = left; x <= right; x++)
+					{
+						remaining[x] &= ~group[x];
+						size += __builtin_popcount(group[x]);
+					}
+					if (size >= 4)
+					{
+						for (unsigned int x = left; x <= right; x++)
+						{
+							vanish[x] |= group[x];
+						}
+						PuyoGroup found;
+						found.color = static_cast<puyocolor>(c);
+						found.size = size;
+						groups.push_back(found);
+					}
+				}
+			}
+		}
+	}
+
+	// vanishのぷよを消す
+	void Vanish(const uint32_t vanish[COLUMN])
+	{
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			for (uint32_t bits = vanish[x]; bits != 0; bits &= bits - 1)
+			{
+				SetValue(__builtin_ctz(bits), x, NONE);
+			}
+		}
+	}
+
+private:
+	static const uint32_t FULL = (uint32_t)((1ULL << LINE) - 1);
+	static const int MASK_NUMBER = PURPLE + 1;
+	puyocell cells[LINE * COLUMN];
+	// NONEの位置には全色の和(占有マスク)を格納する
+	uint32_t masks[MASK_NUMBER][COLUMN];
+};
+
+// 公式ルールの盤面 (6列 x 13段 + 見えない14段目)
+typedef PuyoFixedField<14, 6> PuyoStandardField;
+
+// 組ぷよの置き方
+// columnは軸ぷよの列，rotationはPuyoArrayActiveの回転状態と同じ
+// 0: 子ぷよが右，1: 子ぷよが下，2: 子ぷよが左，3: 子ぷよが上
+struct PuyoPlacement
+{
+	int column;
+	int rotation;
+};
+
+// 置き方と，そのときに軸ぷよと子ぷよが止まる位置
+struct PuyoLanding
+{
+	PuyoPlacement placement;
+	int axisY;
+	int axisX;
+	int childY;
+	int childX;
+};
+
+// COLUMN列の盤面の置き方の一覧
+// 子ぷよが盤面からはみ出すものを除いた 4 * COLUMN - 2 通りを，組ぷよが占める列の範囲と合わせて持つ
+template <unsigned int COLUMN>
+struct PuyoPlacementTable
+{
+	static constexpr unsigned int COUNT = COLUMN * 4 - 2;
+	PuyoPlacement placements[COUNT];
+	int childColumn[COUNT];
+
+	constexpr PuyoPlacementTable() : placements(), childColumn()
+	{
+		unsigned int n = 0;
+		for (int x = 0; x < (int)COLUMN; x++)
+		{
+			for (int r = 0; r < 4; r++)
+			{
+				int child = x + PuyoArrayActive::CHILD_X[r];
+				if (child < 0 || child >= (int)COLUMN)
+				{
+					continue;
+				}
+				placements[n].column = x;
+				placements[n].rotation = r;
+				childColumn[n] = child;
+				n++;
+			}
+		}
+	}
+};
+
+// 組ぷよを置ける場所を求める
+// PuyoControl::Updateは入力の前に着地判定をするので，組ぷよは真下がふさがった位置に来たところで止まる
+// 出現した組ぷよは1段落ちるまで動かせず，その後は上から2段目(1行目)で動かすのがいちばん制約が少ない
+// そのため回転ごとに，置ける軸ぷよの列は連続した範囲になる (Reachを参照)
+// 止まる位置は1段ずつ落として調べず，列のいちばん上のぷよの行から求める
+// どれも呼び出し側の配列に書くだけで，メモリの確保はしない
+class PuyoPlacer
+{
+public:
+	// column列の盤面での置き方の数の上限
+	static unsigned int MaxCount(unsigned int column)
+	{
+		return column * 4 - 2;
+	}
+
+	// fieldにpairを置けるすべての置き方をlandingsに書き，その数を返す
+	// landingsにはMaxCount(列数)個以上の大きさが要る
+	// 軸ぷよと子ぷよが同じ色なら，結果が同じになる置き方(回転2と，回転1でも置ける回転3)は除く
+	template <class Field>
+	static unsigned int Enumerate(const Field &field, const PuyoPair &pair, int spawnColumn, PuyoLanding *landings)
+	{
+		int low[4], high[4];
+		Reach(field, spawnColumn, low, high);
+
+		// 隣の列の高さも使うので，3列分を持ち回る
+		unsigned int count = 0;
+		int column = field.GetColumn();
+		int previousTop = 0;
+		int top = field.GetTop(0);
+		for (int x = 0; x < column; x++)
+		{
+			int nextTop = (x + 1 < column) ? field.GetTop(x + 1) : 0;
+			for (int r = 0; r < 4; r++)
+			{
+				if (x < low[r] || x > high[r] || (pair.axis == pair.child && IsDuplicate(r, x, low, high)))
+				{
+					continue;
+				}
+				int child = x + PuyoArrayActive::CHILD_X[r];
+				PuyoPlacement placement;
+				placement.column = x;
+				placement.rotation = r;
+				Land(placement, top, (child > x) ? nextTop : (child < x) ? previousTop : top, landings[count++]);
+			}
+			previousTop = top;
+			top = nextTop;
+		}
+		return count;
+	}
+
+	// 固定の大きさの盤面では，あらかじめ作った置き方の表を使う
+	template <unsigned int LINE, unsigned int COLUMN>
+	static unsigned int Enumerate(const PuyoFixedField<LINE, COLUMN> &field, const PuyoPair &pair, int spawnColumn, PuyoLanding *landings)
+	{
+		static constexpr PuyoPlacementTable<COLUMN> table;
+		int low[4], high[4];
+		Reach(field, spawnColumn, low, high);
+		int tops[COLUMN];
+		for (unsigned int x = 0; x < COLUMN; x++)
+		{
+			tops[x] = field.GetTop(x);
+		}
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < table.COUNT; i++)
+		{
+			int x = table.placements[i].column;
+			int r = table.placements[i].rotation;
+			if (x < low[r] || x > high[r] || (pair.axis == pair.child && IsDuplicate(r, x, low, high)))
+			{
+				continue;
+			}
+			Land(table.placements[i], tops[x], tops[table.childColumn[i]], landings[count++]);
+		}
+		return count;
+	}
+
+	// 1つの置き方について，置けるかどうかと止まる位置を求める
+	template <class Field>
+	static bool Locate(const Field &field, int spawnColumn, const PuyoPlacement &placement, PuyoLanding &landing)
+	{
+		int rotation = placement.rotation & 3;
+		int axisX = placement.column;
+		int low[4], high[4];
+		Reach(field, spawnColumn, low, high);
+		if (axisX < low[rotation] || axisX > high[rotation])
+		{
+			return false;
+		}
+		int childX = axisX + PuyoArrayActive::CHILD_X[rotation];
+		Land(placement, field.GetTop(axisX), field.GetTop(childX), landing);
+		return true;
+	}
+
+	// 回転rで置ける軸ぷよの列の範囲[low[r], high[r]]を求める (置けなければlow[r] > high[r])
+	// 組ぷよが浮いたまま動けるのは，1行目で真下が空いている間だけ
+	// - 横向きと子ぷよが上 (回転0, 2, 3): 上3段が空いた列を通れる．その先の列も上2段が空いていれば入って着地できる
+	// - 子ぷよが下 (回転1): 子ぷよが2行目に来るので，上3段が空いた列で回転0から回すか横に動かして着地する
+	//   浮いたまま回転1で動けるのは上4段が空いた列だけ
+	// - 回転は時計回りだけなので，回転2と3には上4段が空いた列で回転1のまま浮いてから回す必要がある
+	// 出現位置の下がふさがっていれば，組ぷよはその場で着地する
+	template <class Field>
+	static void Reach(const Field &field, int spawnColumn, int *low, int *high)
+	{
+		for (int r = 0; r < 4; r++)
+		{
+			low[r] = 0;
+			high[r] = -1;
+		}
+		int spawnTop = std::min(TopOf(field, spawnColumn), TopOf(field, spawnColumn + 1));
+		if (spawnTop == 0)
+		{
+			return;
+		}
+		if (spawnTop <= LANDING_TOP)
+		{
+			low[0] = high[0] = spawnColumn;
+			return;
+		}
+
+		// [left, right]: 浮いたまま通れる列，[outerLeft, outerRight]: 入って着地できる列まで
+		int left = spawnColumn;
+		while (TopOf(field, left - 1) > LANDING_TOP)
+		{
+			left--;
+		}
+		int right = spawnColumn + 1;
+		while (TopOf(field, right + 1) > LANDING_TOP)
+		{
+			right++;
+		}
+		int outerLeft = (TopOf(field, left - 1) == LANDING_TOP) ? left - 1 : left;
+		int outerRight = (TopOf(field, right + 1) == LANDING_TOP) ? right + 1 : right;
+
+		low[0] = outerLeft;
+		high[0] = outerRight - 1;
+
+		// 回転0から回せるのは右隣も通れる列，右端の列へは左隣で浮いたまま動かす
+		low[1] = left;
+		high[1] = (TopOf(field, right - 1) > LANDING_TOP + 1) ? right : right - 1;
+
+		// 回転1で浮いたまま，左隣へ子ぷよを回せる列があるか
+		bool turn = false;
+		for (int x = left + 1; x <= high[1]; x++)
+		{
+			if (TopOf(field, x) > LANDING_TOP + 1)
+			{
+				turn = true;
+				break;
+			}
+		}
+		if (turn)
+		{
+			low[2] = outerLeft + 1;
+			high[2] = outerRight;
+			low[3] = outerLeft;
+			high[3] = outerRight;
+		}
+	}
+
+private:
+	// x列目のいちばん上のぷよの行 (盤面の外は最上段まで埋まっているものとする)
+	template <class Field>
+	static int TopOf(const Field &field, int x)
+	{
+		return (x >= 0 && x < (int)field.GetColumn()) ? (int)field.GetTop(x) : 0;
+	}
+
+	// 軸ぷよと子ぷよが同じ色のとき，回転rの置き方が別の回転と同じ結果になるか
+	static bool IsDuplicate(int r, int x, const int *low, const int *high)
+	{
+		// 回転2は1列左の回転0と同じ (置ける範囲も同じ)
+		if (r == 2)
+		{
+			return true;
+		}
+		// 回転3は同じ列の回転1と同じ
+		return r == 3 && x >= low[1] && x <= high[1];
+	}
+
+	// 組ぷよが1行目でこの列に入ると，真下がふさがっていてそこで着地する
+	static const int LANDING_TOP = 2;
+
+	// 列のいちばん上のぷよの行から，軸ぷよと子ぷよの止まる位置を求める
+	static void Land(const PuyoPlacement &placement, int axisTop, int childTop, PuyoLanding &landing)
+	{
+		int rotation = placement.rotation & 3;
+		landing.placement = placement;
+		landing.axisX = placement.column;
+		landing.childX = placement.column + PuyoArrayActive::CHILD_X[rotation];
+		if (landing.axisX != landing.childX)
+		{
+			landing.axisY = axisTop - 1;
+			landing.childY = childTop - 1;
+		}
+		else if (rotation == 1)
+		{
+			// 子ぷよが下なら子ぷよが先に着地する
+			landing.childY = axisTop - 1;
+			landing.axisY = axisTop - 2;
+		}
+		else
+		{
+			landing.axisY = axisTop - 1;
+			landing.childY = axisTop - 2;
+		}
+	}
+};
+
+// 連鎖の計算
+// 画面表示や待ち時間を一切持たず，盤面から連鎖の結果だけを求める
+class PuyoChainSimulator
+{
+public:
+	// 連鎖1回分の得点を計算する
+	// chainCountはこの消滅より前の連鎖数 (1連鎖目なら0)
+	static void ScoreStep(const std::vector<PuyoGroup> &groups, int chainCount, PuyoChainStep &step)
+	{
+		static const int chainBonus[] = {0, 8, 16, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 480, 512};
+		static const int connectionBonus[] = {0, 2, 3, 4, 5, 6, 7, 10};
+		static const int colorBonus[] = {0, 3, 6, 12, 24};
+		const int chainBonusNum = sizeof(chainBonus) / sizeof(chainBonus[0]);
+		const int connectionBonusNum = sizeof(connectionBonus) / sizeof(connectionBonus[0]);
+
+		step.vanished = 0;
+		step.colors = 0;
+		step.connectionBonus = 0;
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			int vanishnum = groups[i].size;
+			// 連結ボーナス計算
+			if (vanishnum - 4 >= connectionBonusNum)
+			{
+				step.connectionBonus += connectionBonus[connectionBonusNum - 1];
+			}
+			else
+			{
+				step.connectionBonus += connectionBonus[vanishnum - 4];
+			}
+			step.vanished += vanishnum;
+			step.colors |= 1 << groups[i].color;
+		}
+		if (step.vanished == 0)
+		{
+			step.chainBonus = 0;
+			step.colorBonus = 0;
+			step.score = 0;
+			return;
+		}
+
+		// 色数ボーナスの計算
+		int colorCount = __builtin_popcount(step.colors);
+		step.colorBonus = colorBonus[colorCount - 1];
+		// 連鎖ボーナスの計算
+		step.chainBonus = chainBonus[std::min(chainCount, chainBonusNum - 1)];
+		// 得点計算
+		int totalBonus = step.chainBonus + step.connectionBonus + step.colorBonus;
+		if (totalBonus == 0)
+		{
+			totalBonus = 1;
+		}
+		step.score = step.vanished * totalBonus * 10;
+	}
+
+	// fieldの連鎖を最後まで計算する (fieldは変更しない)
+	void Simulate(const PuyoArrayStack &field, PuyoChainResult &result)
+	{
+		result.field = field;
+		Resolve(result.field, result);
+	}
+
+	// fieldの連鎖をその場で最後まで計算する
+	// fieldは連鎖後の盤面になり，result.fieldは使わない
+	void Resolve(PuyoArrayStack &field, PuyoChainResult &result)
+	{
+		// 公式ルールの大きさなら固定サイズの盤面で計算する
+		if (standard.Load(field))
+		{
+			if (Resolve(standard, result))
+			{
+				standard.Store(field);
+			}
+			return;
+		}
+
+		result.chain = 0;
+		result.score = 0;
+		result.allClear = false;
+		result.steps.clear();
+
+		// 落下しきっていない盤面にも対応する
+		ApplyGravity(field, falls);
+		while (1)
+		{
+			FindVanishGroups(field, groups, cells);
+			if (groups.empty())
+			{
+				break;
+			}
+			for (size_t i = 0; i < cells.size(); i++)
+			{
+				field.SetValue(cells[i] / field.GetColumn(), cells[i] % field.GetColumn(), NONE);
+			}
+
+			result.steps.push_back(PuyoChainStep());
+			PuyoChainStep &step = result.steps.back();
+			ScoreStep(groups, result.chain, step);
+			step.groups = groups;
+			result.chain++;
+			result.score += step.score;
+
+			ApplyGravity(field, falls);
+		}
+		result.allClear = (result.chain > 0 && field.CountPuyo() == 0);
+	}
+
+	// 固定サイズの盤面の連鎖をその場で最後まで計算する
+	// 盤面が変わった(落下または連鎖があった)場合trueを返す
+	template <unsigned int LINE, unsigned int COLUMN>
+	bool Resolve(PuyoFixedField<LINE, COLUMN> &field, PuyoChainResult &result)
+	{
+		result.chain = 0;
+		result.score = 0;
+		result.allClear = false;
+		result.steps.clear();
+
+		uint32_t vanish[COLUMN];
+		bool moved = field.ApplyGravity();
+		while (1)
+		{
+			field.FindVanishGroups(groups, vanish);
+			if (groups.empty())
+			{
+				break;
+			}
+			field.Vanish(vanish);
+
+			result.steps.push_back(PuyoChainStep());
+			PuyoChainStep &step = result.steps.back();
+			ScoreStep(groups, result.chain, step);
+			step.groups = groups;
+			result.chain++;
+			result.score += step.score;
+
+			field.ApplyGravity();
+		}
+		result.allClear = (result.chain > 0 && field.CountPuyo() == 0);
+		return moved || result.chain > 0;
+	}
+
+	// 盤面全体を1回だけ走査して，4個以上連結したぷよのグループを求める
+	// groupsに各グループの色と個数を，cellsに消滅する座標(y * 列数 + x)をグループ順に格納する
+	void FindVanishGroups(PuyoArrayStack &stack, std::vector<PuyoGroup> &groups, std::vector<unsigned int> &cells)
+	{
+		groups.clear();
+		cells.clear();
+
+		// 4個以上ある色のうち，同じ色のぷよが隣接しているものだけを探索の起点にする
+		puyocolor candidateColors[PURPLE];
+		int candidateNum = 0;
+		for (int c = RED; c <= PURPLE; c++)
+		{
+			if (stack.GetColorCount(static_cast<puyocolor>(c)) >= 4)
+			{
+				candidateColors[candidateNum++] = static_cast<puyocolor>(c);
+			}
+		}
+		if (candidateNum == 0)
+		{
+			return;
+		}
+
+		unsigned int line = stack.GetLine();
+		unsigned int column = stack.GetColumn();
+		// 判定済みフラグ
+		checked.assign(line * column, 0);
+
+		unsigned int words = stack.GetBitboard().GetWords();
+		std::vector<uint64_t> candidate(words);
+		std::vector<uint64_t> connected(words);
+		for (unsigned int y = 0; y < line; y++)
+		{
+			std::fill(candidate.begin(), candidate.end(), 0);
+			for (int i = 0; i < candidateNum; i++)
+			{
+				stack.GetBitboard().ConnectedRow(candidateColors[i], y, &connected[0]);
+				for (unsigned int w = 0; w < words; w++)
+				{
+					candidate[w] |= connected[w];
+				}
+			}
+
+			for (unsigned int w = 0; w < words; w++)
+			{
+				for (uint64_t bits = candidate[w]; bits != 0; bits &= bits - 1)
+				{
+					unsigned int start = y * column + w * 64 + __builtin_ctzll(bits);
+					if (checked[start])
+					{
+						continue;
+					}
+
+					// 明示的なスタックで同じ色のぷよをたどる
+					puyocolor color = stack.GetValue(y, start % column);
+					size_t first = cells.size();
+					checked[start] = 1;
+					searchStack.clear();
+					searchStack.push_back(start);
+					while (!searchStack.empty())
+					{
+						unsigned int pos = searchStack.back();
+						searchStack.pop_back();
+						cells.push_back(pos);
+
+						unsigned int yy = pos / column;
+						unsigned int xx = pos % column;
+						unsigned int next[4];
+						int nextnum = 0;
+						if (xx + 1 < column)
+						{
+							next[nextnum++] = pos + 1;
+						}
+						if (xx > 0)
+						{
+							next[nextnum++] = pos - 1;
+						}
+						if (yy + 1 < line)
+						{
+							next[nextnum++] = pos + column;
+						}
+						if (yy > 0)
+						{
+							next[nextnum++] = pos - column;
+						}
+						for (int i = 0; i < nextnum; i++)
+						{
+							if (!checked[next[i]] && stack.GetValue(next[i] / column, next[i] % column) == color)
+							{
+								checked[next[i]] = 1;
+								searchStack.push_back(next[i]);
+							}
+						}
+					}
+
+					// 4個未満なら消滅対象から外す
+					int size = cells.size() - first;
+					if (size < 4)
+					{
+						cells.resize(first);
+						continue;
+					}
+					PuyoGroup group;
+					group.color = color;
+					group.size = size;
+					groups.push_back(group);
+				}
+			}
+		}
+	}
+
+	// 各列を下から1回ずつ走査して，浮いたぷよを下に詰める
+	// 移動したぷよをfallsに格納し，1つでも移動すればtrueを返す
+	static bool ApplyGravity(PuyoArrayStack &stack, std::vector<PuyoFall> &falls)
+	{
+		falls.clear();
+		for (unsigned int x = 0; x < stack.GetColumn(); x++)
+		{
+			// 下に詰まっている列は飛ばす
+			if (stack.IsSettled(x))
+			{
+				continue;
+			}
+			// bottomは次にぷよを置く行
+			int bottom = stack.GetLine() - 1;
+			int top = stack.GetTop(x);
+			for (int y = stack.GetLine() - 1; y >= top; y--)
+			{
+				puyocolor color = stack.GetValue(y, x);
+				if (color == NONE)
+				{
+					continue;
+				}
+				if (y != bottom)
+				{
+					stack.SetValue(bottom, x, color);
+					stack.SetValue(y, x, NONE);
+
+					PuyoFall fall;
+					fall.x = x;
+					fall.from = y;
+					fall.to = bottom;
+					fall.color = color;
+					falls.push_back(fall);
+				}
+				bottom--;
+			}
+		}
+		return !falls.empty();
+	}
+
+private:
+	// 作業領域 (呼び出しごとの確保を避けるため保持する)
+	std::vector<PuyoGroup> groups;
+	std::vector<unsigned int> cells;
+	std::vector<PuyoFall> falls;
+	std::vector<unsigned char> checked;
+	std::vector<unsigned int> searchStack;
+	PuyoStandardField standard;
+};
+
+// 盤面の連鎖結果を求める
+inline PuyoChainResult SimulateChain(const PuyoArrayStack &field)
+{
+	PuyoChainSimulator simulator;
+	PuyoChainResult result;
+	simulator.Simulate(field, result);
+	return result;
+}
+
+class PuyoControl
+{
+public:
+	void GeneratePuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (IsSpawnBlocked(stack))
+		{
+			return;
+		}
+
+		active.SetPuyoRate(0);
+		SetChainCount(0);
+
+		GenerateNextPuyo(active, stack);
+
+		PuyoPair pair;
+		pair.axis = active.GetNextPuyoValue(0, 0);
+		pair.child = active.GetNextPuyoValue(0, 1);
+		active.SetPiece(0, SpawnColumn, 0, pair);
+	}
+
+private:
+	void GenerateNextPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		PuyoPair pair;
+		if (active.GetNextPuyoValue(1, 0) == NONE || active.GetNextPuyoValue(1, 1) == NONE)
+		{
+			pair = TakePair();
+			active.SetNextPuyoValue(0, 0, pair.axis);
+			active.SetNextPuyoValue(0, 1, pair.child);
+			pair = TakePair();
+			active.SetNextPuyoValue(1, 0, pair.axis);
+			active.SetNextPuyoValue(1, 1, pair.child);
+		}
+		else
+		{
+			active.SetNextPuyoValue(0, 0, active.GetNextPuyoValue(1, 0));
+			active.SetNextPuyoValue(0, 1, active.GetNextPuyoValue(1, 1));
+			active.SetNextPuyoValue(1, 0, active.GetNextPuyoValue(2, 0));
+			active.SetNextPuyoValue(1, 1, active.GetNextPuyoValue(2, 1));
+		}
+
+		pair = TakePair();
+		active.SetNextPuyoValue(2, 0, pair.axis);
+		active.SetNextPuyoValue(2, 1, pair.child);
+	}
+
+	// 待ち行列から次の組ぷよを取り出し，先読み分を補充する
+	PuyoPair TakePair()
+	{
+		FillUpcoming();
+		PuyoPair pair = upcoming.Pop();
+		colorPos += 2;
+		FillUpcoming();
+		return pair;
+	}
+
+	void FillUpcoming()
+	{
+		while (upcoming.GetCount() < (size_t)Lookahead)
+		{
+			PuyoPair pair;
+			pair.axis = RandomColor();
+			pair.child = RandomColor();
+			upcoming.Push(pair);
+		}
+	}
+
+public:
+	// ゲームを1回分進める
+	// 着地していれば着地後の処理(Step)を行い，そうでなければinputの操作を行う
+	// gravityがtrueなら最後に落下中ぷよを1段落とす
+	// 次のぷよを生成した場合trueを返す
+	bool Update(PuyoArrayActive &active, PuyoArrayStack &stack, puyoinput input, bool gravity)
+	{
+		bool generated = false;
+		if (LandingPuyo(active, stack))
+		{
+			generated = Step(active, stack);
+		}
+		else if (CanMove(active, stack))
+		{
+			switch (input)
+			{
+			case INPUT_LEFT:
+				MoveLeft(active, stack);
+				break;
+			case INPUT_RIGHT:
+				MoveRight(active, stack);
+				break;
+			case INPUT_DOWN:
+				MoveDown(active, stack);
+				break;
+			case INPUT_ROTATE:
+				Rotate(active, stack);
+				break;
+			default:
+				break;
+			}
+		}
+		if (gravity)
+		{
+			MoveDown(active, stack);
+		}
+		return generated;
+	}
+
+	// 着地後の処理を1回進める
+	// ぷよの消滅と浮いたぷよの落下を行い，盤面が安定していれば次のぷよを生成する
+	// 次のぷよを生成した場合trueを返す
+	bool Step(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		VanishPuyo(active, stack);
+		if (LandFloating(active, stack))
+		{
+			return false;
+		}
+		GeneratePuyo(active, stack);
+		return true;
+	}
+
+	// 連鎖が終わるまでぷよの消滅と落下を繰り返す
+	// 連鎖数を返す
+	int ResolveChain(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		while (VanishPuyo(active, stack) > 0)
+		{
+			LandFloating(active, stack);
+		}
+		return GetChainCount();
+	}
+
+	// 着地判定
+	// 組ぷよのどちらかが最下段にあるか直下に着地済みぷよがあれば，2つとも着地済みぷよにする
+	// 片方だけ支えられていた場合は，もう片方を浮いたぷよとして落とす
+	// 組ぷよは常に各列のいちばん上のぷよより上にあるので，列の高さだけで判定できる
+	bool LandingPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (active.IsFalling() && (active.GetAxisY() + 1 >= stack.GetTop(active.GetAxisX()) || active.GetChildY() + 1 >= stack.GetTop(active.GetChildX())))
+		{
+			stack.SetValue(active.GetAxisY(), active.GetAxisX(), active.GetPair().axis);
+			stack.SetValue(active.GetChildY(), active.GetChildX(), active.GetPair().child);
+			active.ClearPiece();
+			LandFloating(active, stack);
+		}
+
+		if (active.IsFalling())
+		{
+			return false;
+		}
+		if (GetChainCount() == 0 && listener != NULL)
+		{
+			listener->OnScoreClear();
+		}
+		return true;
+	}
+
+	// 浮いた着地済みぷよの着地処理
+	bool LandFloating(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (!PuyoChainSimulator::ApplyGravity(stack, falls))
+		{
+			return false;
+		}
+		if (listener != NULL)
+		{
+			listener->OnFall(active, stack, falls);
+		}
+		return true;
+	}
+
+	// 左移動
+	void MoveLeft(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (active.IsFalling() && CanPlace(active, stack, 0, -1))
+		{
+			active.MovePiece(0, -1);
+		}
+	}
+
+	// 右移動
+	void MoveRight(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (active.IsFalling() && CanPlace(active, stack, 0, 1))
+		{
+			active.MovePiece(0, 1);
+		}
+	}
+
+	// 下移動
+	void MoveDown(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (active.IsFalling() && CanPlace(active, stack, 1, 0))
+		{
+			active.MovePiece(1, 0);
+		}
+	}
+
+	// ぷよ消滅処理を全座標で行う
+	// 消滅したぷよの数を返す
+	// 得点計算を行う
+	int VanishPuyo(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		simulator.FindVanishGroups(stack, vanishGroups, vanishCells);
+		if (vanishGroups.empty())
+		{
+			return 0;
+		}
+
+		// 消滅するぷよを消す (点滅などの演出は表示側で行う)
+		for (size_t i = 0; i < vanishCells.size(); i++)
+		{
+			stack.SetValue(vanishCells[i] / stack.GetColumn(), vanishCells[i] % stack.GetColumn(), NONE);
+		}
+		if (listener != NULL)
+		{
+			listener->OnVanish(active, stack, vanishGroups, vanishCells);
+		}
+
+		// 得点計算
+		PuyoChainStep step;
+		PuyoChainSimulator::ScoreStep(vanishGroups, GetChainCount(), step);
+		AddChainCount(1);
+		stack.AddScore(step.score);
+		stack.SetNowScore(step.score);
+		if (listener != NULL)
+		{
+			listener->OnScore(active, stack);
+		}
+
+		return step.vanished;
+	}
+
+	// 子ぷよを軸ぷよの周りに時計回りに90度回す
+	// 回した後の子ぷよの位置と，回る途中で通る斜めの位置が空いていれば回す
+	void Rotate(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (!active.IsFalling())
+		{
+			return;
+		}
+		int rotate = active.GetPuyoRotate();
+		int next = (rotate + 1) & 3;
+		int y = active.GetAxisY() + PuyoArrayActive::CHILD_Y[next];
+		int x = active.GetAxisX() + PuyoArrayActive::CHILD_X[next];
+		if (!IsEmpty(stack, y, x) || !IsEmpty(stack, y + PuyoArrayActive::CHILD_Y[rotate], x + PuyoArrayActive::CHILD_X[rotate]))
+		{
+			return;
+		}
+		active.SetPuyoRate(next);
+	}
+
+	void ResetGame(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		active.ClearPiece();
+		// ぷよのある列だけを上から消す
+		for (unsigned int x = 0; x < stack.GetColumn(); x++)
+		{
+			for (unsigned int y = stack.GetTop(x); y < stack.GetLine(); y++)
+			{
+				stack.SetValue(y, x, NONE);
+			}
+		}
+		stack.SetNowScore(0);
+		stack.SetScore(0);
+
+		// ネクストも空にして，毎回同じ状態からゲームを始める
+		for (int y = 0; y < 3; y++)
+		{
+			for (int x = 0; x < 2; x++)
+			{
+				active.SetNextPuyoValue(y, x, NONE);
+			}
+		}
+		active.SetPuyoRate(0);
+		SetChainCount(0);
+	}
+
+	// 落下中ぷよは操作可能か判定
+	bool CanMove(PuyoArrayActive &active, PuyoArrayStack &stack)
+	{
+		if (active.GetValue(0, SpawnColumn) != NONE && active.GetValue(0, SpawnColumn + 1) != NONE)
+		{
+			return false;
+		}
+
+		return active.IsFalling();
+	}
+
+	// 出現位置がふさがっているか (列の高さだけで判定する)
+	bool IsSpawnBlocked(const PuyoArrayStack &stack) const
+	{
+		return stack.GetTop(SpawnColumn) == 0 || stack.GetTop(SpawnColumn + 1) == 0;
+	}
+
+private:
+	// (y, x)が盤面の中で，着地済みぷよがないか
+	static bool IsEmpty(const PuyoArrayStack &stack, int y, int x)
+	{
+		return y >= 0 && x >= 0 && y < (int)stack.GetLine() && x < (int)stack.GetColumn() && stack.GetValue(y, x) == NONE;
+	}
+
+	// 落下中の組ぷよを(dy, dx)だけ動かした位置に置けるか
+	static bool CanPlace(const PuyoArrayActive &active, const PuyoArrayStack &stack, int dy, int dx)
+	{
+		return IsEmpty(stack, active.GetAxisY() + dy, active.GetAxisX() + dx) && IsEmpty(stack, active.GetChildY() + dy, active.GetChildX() + dx);
+	}
+
+private:
+	// ランダムなぷよ色を生成
+	puyocolor RandomColor()
+	{
+		int colornumber = GetColorNum();
+
+		// 記録済みの色列を再生中ならそれを使う
+		if (colorScripted && scriptPos < colorLog.size())
+		{
+			return colorLog[scriptPos++];
+		}
+
+		int randomIndex = 1 + random.Below(colornumber);
+
+		// ランダムな整数を列挙型の値に変換する
+		puyocolor newpuyo;
+		newpuyo = static_cast<puyocolor>(randomIndex);
+		if (colorRecording)
+		{
+			colorLog.push_back(newpuyo);
+		}
+		return newpuyo;
+
+		/*
+		std::random_device rd;
+		std::mt19937 gen(rd());
+		std::uniform_int_distribution<> distribution(0, colornumber - 1);
+
+		int randomIndex = distribution(gen) + 1;
+		puyocolor newpuyo;
+		newpuyo = static_cast<puyocolor>(randomIndex);
+		return newpuyo;
+		*/
+	}
+
+private:
+	int ChainCount;
+	int MaxChain;
+	int ColorNum;
+	uint64_t Seed;
+	// ネクスト表示より先に生成しておく組ぷよの数
+	int Lookahead;
+	// 組ぷよが出現する列 (軸ぷよの列，子ぷよはその右)
+	int SpawnColumn;
+	PuyoControlListener *listener;
+	PuyoRandom random;
+	PuyoPairQueue upcoming;
+
+	// 生成したぷよの色の記録 (リプレイ用)
+	std::vector<puyocolor> colorLog;
+	// ネクストに出した色の数
+	size_t colorPos;
+	// 色列のうち待ち行列に読み込んだ数
+	size_t scriptPos;
+	bool colorRecording;
+	bool colorScripted;
+
+	// 消滅判定用の作業領域 (呼び出しごとの確保を避けるため保持する)
+	std::vector<PuyoGroup> vanishGroups;
+	std::vector<unsigned int> vanishCells;
+	std::vector<PuyoFall> falls;
+	PuyoChainSimulator simulator;
+
+public:
+	PuyoControl()
+	{
+		// 表示側への通知先 (NULLなら通知しない)
+		listener = NULL;
+
+		// 連鎖数
+		ChainCount = 0;
+
+		// 最大連鎖数
+		MaxChain = 0;
+
+		// ぷよの色数
+		ColorNum = 4;
+
+		// 乱数生成器を初期化する
+		Seed = std::time(NULL);
+		random.Seed(Seed);
+		Lookahead = 4;
+		SpawnColumn = 5;
+		colorPos = 0;
+		scriptPos = 0;
+		colorRecording = false;
+		colorScripted = false;
+	}
+
+	// 乱数の種を設定し，以降に生成する色の記録を始める
+	// 同じ種からは先読みの数によらず同じ組ぷよの列が出る
+	void SetSeed(uint64_t seed)
+	{
+		Seed = seed;
+		random.Seed(seed);
+		upcoming.Clear();
+		colorLog.clear();
+		colorPos = 0;
+		scriptPos = 0;
+		colorRecording = true;
+		colorScripted = false;
+	}
+	uint64_t GetSeed() const
+	{
+		return Seed;
+	}
+
+	// 記録された色列を先頭から順に使うようにする (リプレイ再生用)
+	// 色列を使い切った後は乱数で生成する
+	void SetColorScript(const std::vector<puyocolor> &colors)
+	{
+		colorLog = colors;
+		upcoming.Clear();
+		colorPos = 0;
+		scriptPos = 0;
+		colorRecording = false;
+		colorScripted = true;
+	}
+
+	// ネクスト表示(3組)より先に生成しておく組ぷよの数
+	int GetLookahead() const
+	{
+		return Lookahead;
+	}
+	void SetLookahead(int num)
+	{
+		Lookahead = std::max(1, num);
+	}
+
+	// 組ぷよが出現する列
+	int GetSpawnColumn() const
+	{
+		return SpawnColumn;
+	}
+	void SetSpawnColumn(int column)
+	{
+		SpawnColumn = std::max(0, column);
+	}
+	// column列の盤面で出現させる列
+	// 端末に合わせた広い盤面では従来どおり5列目，それより狭い盤面(6列の標準盤面など)では中央
+	static int SpawnColumnFor(unsigned int column)
+	{
+		return (column >= 7) ? 5 : static_cast<int>(column / 2) - 1;
+	}
+
+	// ネクスト表示の後に出てくるindex番目の組ぷよ (index < GetLookahead())
+	PuyoPair GetUpcomingPair(unsigned int index)
+	{
+		FillUpcoming();
+		return upcoming.Peek(index);
+	}
+
+	// SetSeed以降に生成した色，またはSetColorScriptで与えた色列
+	const std::vector<puyocolor> &GetColorLog() const
+	{
+		return colorLog;
+	}
+
+	// 色列のうち使用済みの数
+	size_t GetColorPosition() const
+	{
+		return colorPos;
+	}
+	// 再生中なら待ち行列をその位置から読み込み直す
+	void SetColorPosition(size_t position)
+	{
+		colorPos = position;
+		if (colorScripted)
+		{
+			upcoming.Clear();
+			scriptPos = position;
+		}
+	}
+
+	void SetListener(PuyoControlListener *newlistener)
+	{
+		listener = newlistener;
+	}
+
+	int GetChainCount() const
+	{
+		return ChainCount;
+	}
+	void AddChainCount(int num)
+	{
+		ChainCount += num;
+		if (ChainCount > MaxChain)
+		{
+			SetMaxChain(ChainCount);
+		}
+	}
+	void SetChainCount(int num)
+	{
+		ChainCount = num;
+	}
+
+	int GetMaxChain() const
+	{
+		return MaxChain;
+	}
+	void SetMaxChain(int num)
+	{
+		MaxChain = num;
+	}
+
+	int GetColorNum() const
+	{
+		return ColorNum;
+	}
+	void SetColorNum(int num)
+	{
+		ColorNum = num;
+	}
+};
+
+#endif
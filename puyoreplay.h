@@ -0,0 +1,547 @@
+#ifndef PUYOREPLAY_H
+#define PUYOREPLAY_H
+
+// ゲームの記録と再生
+// 乱数の種，生成したぷよの色列，時刻つきの入力を可変長整数で詰めたバイナリファイルに保存する
+// 一定間隔で盤面のキーフレームを持つので，途中の時刻から再生を始められる
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "puyoengine.h"
+
+// 記録する出来事の種類
+enum puyoreplayevent
+{
+	// PuyoControl::Updateを1回呼んだ
+	REPLAY_UPDATE,
+	// 一時停止または再開
+	REPLAY_PAUSE,
+	// ゲームを途中でやめた
+	REPLAY_QUIT
+};
+
+struct PuyoReplayEvent
+{
+	// ゲーム開始からの経過時間 (ミリ秒)
+	unsigned int time;
+	puyoreplayevent type;
+	puyoinput input;
+	bool gravity;
+};
+
+// ある時点のゲームの状態
+struct PuyoReplayKeyframe
+{
+	// このキーフレームまでに適用したイベントの数
+	size_t event;
+	unsigned int time;
+	// 落下中の組ぷよ (無ければfallingがfalse)
+	bool falling;
+	int axisY;
+	int axisX;
+	PuyoPair pair;
+	// 着地済みぷよは1マス3ビットに詰めて持つ
+	PuyoPackedField stack;
+	int rotate;
+	unsigned char next[3 * 2];
+	int score;
+	int nowscore;
+	int chain;
+	int maxChain;
+	size_t colorPosition;
+};
+
+class PuyoReplay
+{
+public:
+	// キーフレームを記録する間隔 (イベント数)
+	static const size_t KEYFRAME_INTERVAL = 256;
+
+	PuyoReplay()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		seed = 0;
+		line = 0;
+		column = 0;
+		colorNum = 0;
+		fallInterval = 0;
+		startTime = 0;
+		finalScore = 0;
+		colors.clear();
+		events.clear();
+		keyframes.clear();
+	}
+
+	uint64_t GetSeed() const
+	{
+		return seed;
+	}
+	unsigned int GetLine() const
+	{
+		return line;
+	}
+	unsigned int GetColumn() const
+	{
+		return column;
+	}
+	int GetColorNum() const
+	{
+		return colorNum;
+	}
+	int GetFallInterval() const
+	{
+		return fallInterval;
+	}
+	long long GetStartTime() const
+	{
+		return startTime;
+	}
+	int GetFinalScore() const
+	{
+		return finalScore;
+	}
+	const std::vector<PuyoReplayEvent> &GetEvents() const
+	{
+		return events;
+	}
+	const std::vector<PuyoReplayKeyframe> &GetKeyframes() const
+	{
+		return keyframes;
+	}
+
+	// 記録を始める (ResetGameの直後に呼ぶ)
+	void Begin(PuyoControl &control, PuyoArrayStack &stack, int interval, long long start)
+	{
+		Clear();
+		seed = control.GetSeed();
+		line = stack.GetLine();
+		column = stack.GetColumn();
+		colorNum = control.GetColorNum();
+		fallInterval = interval;
+		startTime = start;
+	}
+
+	// イベントを記録する (REPLAY_UPDATEなら適用した後に呼ぶ)
+	void Record(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack, unsigned int time, puyoreplayevent type, puyoinput input, bool gravity)
+	{
+		PuyoReplayEvent event;
+		event.time = time;
+		event.type = type;
+		event.input = input;
+		event.gravity = gravity;
+		events.push_back(event);
+
+		if (events.size() % KEYFRAME_INTERVAL == 0)
+		{
+			keyframes.push_back(PuyoReplayKeyframe());
+			Capture(control, active, stack, keyframes.back());
+			keyframes.back().event = events.size();
+			keyframes.back().time = time;
+		}
+	}
+
+	// 記録を終える
+	void End(PuyoControl &control, PuyoArrayStack &stack)
+	{
+		colors = control.GetColorLog();
+		finalScore = stack.GetScore();
+	}
+
+	// 再生の準備をして，最初の状態にする
+	void Start(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack) const
+	{
+		active.ChangeSize(line, column);
+		stack.ChangeSize(line, column);
+		// 出現位置は盤面の幅で決まるので記録しない
+		control.SetSpawnColumn(PuyoControl::SpawnColumnFor(column));
+		control.SetColorNum(colorNum);
+		control.SetColorScript(colors);
+		control.SetMaxChain(0);
+		control.ResetGame(active, stack);
+	}
+
+	// index番目のイベントを適用する
+	void Apply(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack, size_t index) const
+	{
+		const PuyoReplayEvent &event = events[index];
+		if (event.type == REPLAY_UPDATE)
+		{
+			control.Update(active, stack, event.input, event.gravity);
+		}
+	}
+
+	// 時刻timeまでのイベントを適用した状態にする
+	// 直前のキーフレームから進めるので，先頭から再生し直す必要はない
+	// 次に適用するイベントの番号を返す
+	size_t Seek(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack, unsigned int time) const
+	{
+		Start(control, active, stack);
+		size_t index = 0;
+		for (size_t i = 0; i < keyframes.size() && keyframes[i].time <= time; i++)
+		{
+			Restore(control, active, stack, keyframes[i]);
+			index = keyframes[i].event;
+		}
+		while (index < events.size() && events[index].time <= time)
+		{
+			Apply(control, active, stack, index);
+			index++;
+		}
+		return index;
+	}
+
+	bool Save(const std::string &filename) const
+	{
+		std::vector<unsigned char> out;
+		out.insert(out.end(), MAGIC, MAGIC + 4);
+		PutVarint(out, VERSION);
+		PutVarint(out, seed);
+		PutVarint(out, line);
+		PutVarint(out, column);
+		PutVarint(out, colorNum);
+		PutVarint(out, fallInterval);
+		PutVarint(out, startTime);
+		PutVarint(out, finalScore);
+
+		// 色は1バイトに2つ詰める
+		PutVarint(out, colors.size());
+		for (size_t i = 0; i < colors.size(); i += 2)
+		{
+			unsigned char high = (i + 1 < colors.size()) ? colors[i + 1] : 0;
+			out.push_back(colors[i] | (high << 4));
+		}
+
+		// 時刻は直前のイベントとの差分
+		PutVarint(out, events.size());
+		unsigned int previous = 0;
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			PutVarint(out, events[i].time - previous);
+			out.push_back(events[i].input | (events[i].gravity ? 0x08 : 0) | (events[i].type << 4));
+			previous = events[i].time;
+		}
+
+		PutVarint(out, keyframes.size());
+		for (size_t i = 0; i < keyframes.size(); i++)
+		{
+			const PuyoReplayKeyframe &keyframe = keyframes[i];
+			PutVarint(out, keyframe.event);
+			PutVarint(out, keyframe.time);
+			// 落下中の組ぷよは軸ぷよの位置と色だけを書く (回転は落下中でなくても書く)
+			out.push_back(keyframe.falling ? 1 : 0);
+			if (keyframe.falling)
+			{
+				PutVarint(out, keyframe.axisY);
+				PutVarint(out, keyframe.axisX);
+				out.push_back(keyframe.pair.axis | (keyframe.pair.child << 4));
+			}
+			PutVarint(out, keyframe.rotate);
+			std::vector<puyocell> cells(line * column);
+			keyframe.stack.Unpack(cells.data());
+			PutCells(out, cells);
+			out.insert(out.end(), keyframe.next, keyframe.next + 3 * 2);
+			PutVarint(out, keyframe.score);
+			PutVarint(out, keyframe.nowscore);
+			PutVarint(out, keyframe.chain);
+			PutVarint(out, keyframe.maxChain);
+			PutVarint(out, keyframe.colorPosition);
+		}
+
+		FILE *file = fopen(filename.c_str(), "wb");
+		if (file == NULL)
+		{
+			return false;
+		}
+		bool written = fwrite(&out[0], 1, out.size(), file) == out.size();
+		return fclose(file) == 0 && written;
+	}
+
+	bool Load(const std::string &filename)
+	{
+		Clear();
+		FILE *file = fopen(filename.c_str(), "rb");
+		if (file == NULL)
+		{
+			return false;
+		}
+		std::vector<unsigned char> in;
+		unsigned char buffer[4096];
+		size_t length;
+		while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		{
+			in.insert(in.end(), buffer, buffer + length);
+		}
+		fclose(file);
+
+		size_t pos = 0;
+		if (in.size() < 4 || memcmp(&in[0], MAGIC, 4) != 0)
+		{
+			return false;
+		}
+		pos = 4;
+		uint64_t value;
+		if (!GetVarint(in, pos, value) || value != VERSION)
+		{
+			return false;
+		}
+
+		uint64_t header[7];
+		for (int i = 0; i < 7; i++)
+		{
+			if (!GetVarint(in, pos, header[i]))
+			{
+				return false;
+			}
+		}
+		// 壊れたファイルで範囲外の読み書きや巨大な確保をしないよう，盤面の大きさと色数を確かめる
+		if (header[1] < 2 || header[1] > MAX_SIZE || header[2] < 2 || header[2] > MAX_SIZE || header[3] < 1 || header[3] > PURPLE)
+		{
+			return false;
+		}
+		seed = header[0];
+		line = header[1];
+		column = header[2];
+		colorNum = header[3];
+		fallInterval = header[4];
+		startTime = header[5];
+		finalScore = header[6];
+
+		uint64_t count;
+		if (!GetVarint(in, pos, count) || in.size() - pos < (count + 1) / 2)
+		{
+			return false;
+		}
+		for (uint64_t i = 0; i < count; i++)
+		{
+			unsigned char packed = in[pos + i / 2];
+			unsigned char color = (i % 2 == 0) ? (packed & 0x0f) : (packed >> 4);
+			if (color > PURPLE)
+			{
+				return false;
+			}
+			colors.push_back(static_cast<puyocolor>(color));
+		}
+		pos += (count + 1) / 2;
+
+		if (!GetVarint(in, pos, count))
+		{
+			return false;
+		}
+		unsigned int time = 0;
+		for (uint64_t i = 0; i < count; i++)
+		{
+			uint64_t delta;
+			if (!GetVarint(in, pos, delta) || pos >= in.size() || (in[pos] & 0x07) > INPUT_ROTATE || (in[pos] >> 4) > REPLAY_QUIT)
+			{
+				return false;
+			}
+			time += delta;
+			PuyoReplayEvent event;
+			event.time = time;
+			event.input = static_cast<puyoinput>(in[pos] & 0x07);
+			event.gravity = (in[pos] & 0x08) != 0;
+			event.type = static_cast<puyoreplayevent>(in[pos] >> 4);
+			pos++;
+			events.push_back(event);
+		}
+
+		if (!GetVarint(in, pos, count))
+		{
+			return false;
+		}
+		for (uint64_t i = 0; i < count; i++)
+		{
+			PuyoReplayKeyframe keyframe;
+			uint64_t fields[2];
+			if (!GetVarint(in, pos, fields[0]) || !GetVarint(in, pos, fields[1]))
+			{
+				return false;
+			}
+			keyframe.event = fields[0];
+			keyframe.time = fields[1];
+			if (pos >= in.size() || in[pos] > 1)
+			{
+				return false;
+			}
+			keyframe.falling = in[pos++] != 0;
+			keyframe.axisY = 0;
+			keyframe.axisX = 0;
+			keyframe.pair.axis = NONE;
+			keyframe.pair.child = NONE;
+			if (keyframe.falling)
+			{
+				if (!GetVarint(in, pos, fields[0]) || !GetVarint(in, pos, fields[1]) || pos >= in.size() || fields[0] >= line || fields[1] >= column)
+				{
+					return false;
+				}
+				keyframe.axisY = fields[0];
+				keyframe.axisX = fields[1];
+				keyframe.pair.axis = static_cast<puyocolor>(in[pos] & 0x0f);
+				keyframe.pair.child = static_cast<puyocolor>(in[pos] >> 4);
+				pos++;
+			}
+			if (!GetVarint(in, pos, value))
+			{
+				return false;
+			}
+			keyframe.rotate = value & 3;
+			// 組ぷよは2つとも盤面の中になければならない
+			if (keyframe.falling && (keyframe.pair.axis > PURPLE || keyframe.pair.child > PURPLE ||
+									 keyframe.axisY + PuyoArrayActive::CHILD_Y[keyframe.rotate] < 0 || keyframe.axisY + PuyoArrayActive::CHILD_Y[keyframe.rotate] >= (int)line ||
+									 keyframe.axisX + PuyoArrayActive::CHILD_X[keyframe.rotate] < 0 || keyframe.axisX + PuyoArrayActive::CHILD_X[keyframe.rotate] >= (int)column))
+			{
+				return false;
+			}
+			std::vector<puyocell> cells;
+			if (!GetCells(in, pos, line * column, cells) || in.size() - pos < 3 * 2)
+			{
+				return false;
+			}
+			keyframe.stack.Pack(cells.data(), line, column);
+			for (int n = 0; n < 3 * 2; n++)
+			{
+				if (in[pos + n] > PURPLE)
+				{
+					return false;
+				}
+				keyframe.next[n] = in[pos + n];
+			}
+			pos += 3 * 2;
+			uint64_t numbers[5];
+			for (int n = 0; n < 5; n++)
+			{
+				if (!GetVarint(in, pos, numbers[n]))
+				{
+					return false;
+				}
+			}
+			keyframe.score = numbers[0];
+			keyframe.nowscore = numbers[1];
+			keyframe.chain = numbers[2];
+			keyframe.maxChain = numbers[3];
+			keyframe.colorPosition = numbers[4];
+			keyframes.push_back(keyframe);
+		}
+		return true;
+	}
+
+private:
+	static const unsigned int VERSION = 2;
+	// 読み込む盤面の縦横の上限
+	static const unsigned int MAX_SIZE = 1024;
+	static constexpr unsigned char MAGIC[4] = {'P', 'U', 'Y', 'R'};
+
+	uint64_t seed;
+	unsigned int line;
+	unsigned int column;
+	int colorNum;
+	int fallInterval;
+	long long startTime;
+	int finalScore;
+	std::vector<puyocolor> colors;
+	std::vector<PuyoReplayEvent> events;
+	std::vector<PuyoReplayKeyframe> keyframes;
+
+	static void Capture(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack, PuyoReplayKeyframe &keyframe)
+	{
+		keyframe.falling = active.IsFalling();
+		keyframe.axisY = active.GetAxisY();
+		keyframe.axisX = active.GetAxisX();
+		keyframe.pair = active.GetPair();
+		keyframe.stack.Pack(stack);
+		keyframe.rotate = active.GetPuyoRotate();
+		for (int i = 0; i < 3 * 2; i++)
+		{
+			keyframe.next[i] = active.GetNextPuyoValue(i / 2, i % 2);
+		}
+		keyframe.score = stack.GetScore();
+		keyframe.nowscore = stack.GetNowscore();
+		keyframe.chain = control.GetChainCount();
+		keyframe.maxChain = control.GetMaxChain();
+		keyframe.colorPosition = control.GetColorPosition();
+	}
+
+	static void Restore(PuyoControl &control, PuyoArrayActive &active, PuyoArrayStack &stack, const PuyoReplayKeyframe &keyframe)
+	{
+		active.ClearPiece();
+		if (keyframe.falling)
+		{
+			active.SetPiece(keyframe.axisY, keyframe.axisX, keyframe.rotate, keyframe.pair);
+		}
+		keyframe.stack.Unpack(stack);
+		active.SetPuyoRate(keyframe.rotate);
+		for (int i = 0; i < 3 * 2; i++)
+		{
+			active.SetNextPuyoValue(i / 2, i % 2, static_cast<puyocolor>(keyframe.next[i]));
+		}
+		stack.SetScore(keyframe.score);
+		stack.SetNowScore(keyframe.nowscore);
+		control.SetChainCount(keyframe.chain);
+		control.SetMaxChain(keyframe.maxChain);
+		control.SetColorPosition(keyframe.colorPosition);
+	}
+
+	// 7bitずつ下位から書き出し，続きがあれば最上位ビットを立てる
+	static void PutVarint(std::vector<unsigned char> &out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(value);
+	}
+
+	static bool GetVarint(const std::vector<unsigned char> &in, size_t &pos, uint64_t &value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
+		{
+			unsigned char byte = in[pos++];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 盤面は同じ色の連続(長さと色)で詰める
+	static void PutCells(std::vector<unsigned char> &out, const std::vector<puyocell> &cells)
+	{
+		for (size_t i = 0; i < cells.size();)
+		{
+			size_t run = 1;
+			while (i + run < cells.size() && cells[i + run] == cells[i])
+			{
+				run++;
+			}
+			PutVarint(out, run);
+			out.push_back(cells[i]);
+			i += run;
+		}
+	}
+
+	static bool GetCells(const std::vector<unsigned char> &in, size_t &pos, size_t count, std::vector<puyocell> &cells)
+	{
+		cells.clear();
+		while (cells.size() < count)
+		{
+			uint64_t run;
+			if (!GetVarint(in, pos, run) || pos >= in.size() || run > count - cells.size() || in[pos] > PURPLE)
+			{
+				return false;
+			}
+			cells.insert(cells.end(), run, in[pos++]);
+		}
+		return true;
+	}
+};
+
+#endif
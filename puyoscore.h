@@ -0,0 +1,517 @@
+#ifndef PUYOSCORE_H
+#define PUYOSCORE_H
+
+// スコアボード
+// 点数の高い順に並べた固定長レコードの配列をファイルに置き，mmapして直接読む
+// 順位の問い合わせは二分探索，表示はページ単位で必要な範囲だけを読む
+//
+// 複数のプロセスから書き込めるように，登録は追記専用のログへの1回のwriteで行い，
+// ログを整列済みファイル(スナップショット)へまとめる処理は別スレッドで行う
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// 1件分のレコード (32バイト)
+struct PuyoScoreEntry
+{
+	int32_t score;
+	char name[28];
+};
+
+class PuyoScoreboard
+{
+public:
+	// 名前の最大長
+	static const size_t NAME_LENGTH = sizeof(((PuyoScoreEntry *)0)->name) - 1;
+
+	PuyoScoreboard() : fd(-1), map(NULL), mapSize(0) {}
+
+	~PuyoScoreboard()
+	{
+		Close();
+	}
+
+	// ファイルを開く (なければ作る)
+	bool Open(const std::string &filename)
+	{
+		Close();
+		fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			Close();
+			return false;
+		}
+		if (st.st_size == 0)
+		{
+			// 空のファイルにはヘッダだけを書く
+			Header header;
+			memcpy(header.magic, MAGIC, 4);
+			header.version = VERSION;
+			header.count = 0;
+			if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+			{
+				Close();
+				return false;
+			}
+			st.st_size = sizeof(header);
+		}
+		if ((size_t)st.st_size < sizeof(Header) || !Map(st.st_size))
+		{
+			Close();
+			return false;
+		}
+		if (memcmp(GetHeader()->magic, MAGIC, 4) != 0 || GetHeader()->version != VERSION ||
+			sizeof(Header) + GetHeader()->count * sizeof(PuyoScoreEntry) > mapSize)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		if (map != NULL)
+		{
+			munmap(map, mapSize);
+			map = NULL;
+			mapSize = 0;
+		}
+		if (fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	bool IsOpen() const
+	{
+		return map != NULL;
+	}
+
+	// filenameが今開いているファイルと同じものか (renameで置き換えられていないか)
+	bool IsSameFile(const std::string &filename) const
+	{
+		struct stat opened, current;
+		if (fd < 0 || fstat(fd, &opened) != 0 || stat(filename.c_str(), &current) != 0)
+		{
+			return false;
+		}
+		return opened.st_dev == current.st_dev && opened.st_ino == current.st_ino;
+	}
+
+	// 他のプロセスが書き足していたら，大きくなったファイルを写し直す
+	bool Refresh()
+	{
+		struct stat st;
+		if (map == NULL || fstat(fd, &st) != 0)
+		{
+			return false;
+		}
+		return (size_t)st.st_size == mapSize || Map(st.st_size);
+	}
+
+	// 写している範囲を超える件数は見ない
+	size_t GetCount() const
+	{
+		if (map == NULL)
+		{
+			return 0;
+		}
+		return std::min<size_t>(GetHeader()->count, (mapSize - sizeof(Header)) / sizeof(PuyoScoreEntry));
+	}
+
+	// rank番目 (0が1位) のレコード
+	const PuyoScoreEntry &Get(size_t rank) const
+	{
+		return GetEntries()[rank];
+	}
+
+	int GetTopScore() const
+	{
+		return GetCount() > 0 ? Get(0).score : 0;
+	}
+
+	// scoreを登録したときの順位 (0が1位)
+	// 同点なら先に登録された方を上にするので，score以上のレコードの数になる
+	size_t Rank(int score) const
+	{
+		const PuyoScoreEntry *entries = GetEntries();
+		size_t low = 0;
+		size_t high = GetCount();
+		while (low < high)
+		{
+			size_t middle = low + (high - low) / 2;
+			if (entries[middle].score >= score)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low;
+	}
+
+	// 整列済みのレコードからファイルを作る
+	static bool Write(const std::string &filename, const std::vector<PuyoScoreEntry> &entries)
+	{
+		int out = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0)
+		{
+			return false;
+		}
+		Header header;
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.count = entries.size();
+		size_t size = entries.size() * sizeof(PuyoScoreEntry);
+		bool written = write(out, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+					   (size == 0 || write(out, &entries[0], size) == (ssize_t)size) && fsync(out) == 0;
+		return close(out) == 0 && written;
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t count;
+	};
+
+	static const uint32_t VERSION = 1;
+	static constexpr char MAGIC[4] = {'P', 'U', 'Y', 'S'};
+
+	int fd;
+	char *map;
+	size_t mapSize;
+
+	bool Map(size_t size)
+	{
+		if (map != NULL)
+		{
+			munmap(map, mapSize);
+			map = NULL;
+			mapSize = 0;
+		}
+		void *address = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			return false;
+		}
+		map = static_cast<char *>(address);
+		mapSize = size;
+		return true;
+	}
+
+	const Header *GetHeader() const
+	{
+		return reinterpret_cast<const Header *>(map);
+	}
+
+	const PuyoScoreEntry *GetEntries() const
+	{
+		return reinterpret_cast<const PuyoScoreEntry *>(map + sizeof(Header));
+	}
+};
+
+// 共有スコアボード
+// basename.dat が整列済みのスナップショット，basename.log が未整列の追記ログ
+// 読む側は両方を合わせた順位を返す
+class PuyoScoreStore
+{
+public:
+	PuyoScoreStore() : logCount(0) {}
+
+	~PuyoScoreStore()
+	{
+		WaitCompaction();
+	}
+
+	bool Open(const std::string &basename)
+	{
+		snapshotName = basename + ".dat";
+		logName = basename + ".log";
+		return Refresh();
+	}
+
+	// 1件登録する
+	// O_APPENDで1レコードを1回のwriteで書くので，他のプロセスの登録と混ざらない
+	// 共有ロックはまとめ処理とぶつからないためだけに取る
+	bool Submit(const std::string &name, int score)
+	{
+		PuyoScoreEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.score = score;
+		strncpy(entry.name, name.c_str(), PuyoScoreboard::NAME_LENGTH);
+
+		int fd = open(logName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+		flock(fd, LOCK_SH);
+		bool written = write(fd, &entry, sizeof(entry)) == (ssize_t)sizeof(entry);
+		flock(fd, LOCK_UN);
+		close(fd);
+		return written;
+	}
+
+	// スナップショットが置き換えられていれば開き直し，ログを読み直す
+	bool Refresh()
+	{
+		int fd = open(logName.c_str(), O_RDONLY | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+		// まとめ処理の途中(スナップショットは新しく，ログはまだ空でない)を見ないようにする
+		flock(fd, LOCK_SH);
+		bool opened = (snapshot.IsOpen() && snapshot.IsSameFile(snapshotName)) ? snapshot.Refresh() : snapshot.Open(snapshotName);
+		ReadLog(fd, log);
+		flock(fd, LOCK_UN);
+		close(fd);
+
+		// 同点なら先に登録された方を上にする
+		std::stable_sort(log.begin(), log.end(), Higher);
+		logCount = log.size();
+		return opened;
+	}
+
+	size_t GetCount() const
+	{
+		return snapshot.GetCount() + logCount;
+	}
+
+	// 未整理のログの件数
+	size_t GetLogCount() const
+	{
+		return logCount;
+	}
+
+	int GetTopScore() const
+	{
+		if (logCount > 0 && (snapshot.GetCount() == 0 || log[0].score > snapshot.GetTopScore()))
+		{
+			return log[0].score;
+		}
+		return snapshot.GetTopScore();
+	}
+
+	// scoreを登録したときの順位 (0が1位)
+	size_t Rank(int score) const
+	{
+		return snapshot.Rank(score) + CountLog(score);
+	}
+
+	// rank番目からcount件 (スナップショットとログを合わせた順)
+	void GetRange(size_t rank, size_t count, std::vector<PuyoScoreEntry> &out) const
+	{
+		out.clear();
+		// 先頭からrank件に含まれるログの件数を求める
+		// ログのj番目は j + (それ以上の点数のスナップショットの件数) 番目に並ぶ
+		size_t low = 0;
+		size_t high = logCount;
+		while (low < high)
+		{
+			size_t middle = low + (high - low) / 2;
+			if (middle + snapshot.Rank(log[middle].score) < rank)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		size_t j = low;
+		size_t i = std::min(rank - j, snapshot.GetCount());
+		while (out.size() < count && (i < snapshot.GetCount() || j < logCount))
+		{
+			if (j == logCount || (i < snapshot.GetCount() && snapshot.Get(i).score >= log[j].score))
+			{
+				out.push_back(snapshot.Get(i++));
+			}
+			else
+			{
+				out.push_back(log[j++]);
+			}
+		}
+	}
+
+	// 旧形式の "名前 点数" が1行ずつ並んだテキストファイルをログに取り込む
+	int Import(const std::string &filename)
+	{
+		FILE *file = fopen(filename.c_str(), "r");
+		if (file == NULL)
+		{
+			return 0;
+		}
+		char name[256];
+		int score;
+		int imported = 0;
+		while (fscanf(file, "%255s %d", name, &score) == 2)
+		{
+			if (Submit(name, score))
+			{
+				imported++;
+			}
+		}
+		fclose(file);
+		return imported;
+	}
+
+	// ログがthreshold件以上たまっていれば，別スレッドでスナップショットにまとめる
+	// 前回のまとめ処理が終わっていなければ何もしない
+	void CompactInBackground(size_t threshold)
+	{
+		if (compactor.joinable())
+		{
+			if (!compacting)
+			{
+				compactor.join();
+			}
+			else
+			{
+				return;
+			}
+		}
+		if (logCount < threshold)
+		{
+			return;
+		}
+		compacting = true;
+		std::string basename = snapshotName.substr(0, snapshotName.size() - 4);
+		compactor = std::thread([this, basename]() {
+			Compact(basename);
+			compacting = false;
+		});
+	}
+
+	void WaitCompaction()
+	{
+		if (compactor.joinable())
+		{
+			compactor.join();
+		}
+	}
+
+	// ログをスナップショットにまとめる
+	// ログに排他ロックをかけて登録を止め，まとめたファイルをrenameで置き換えてからログを空にする
+	// ファイルは自分で開くので，どのスレッドやプロセスから呼んでもよい
+	static bool Compact(const std::string &basename)
+	{
+		std::string snapshotName = basename + ".dat";
+		std::string logName = basename + ".log";
+		std::string temporaryName = basename + ".dat.tmp";
+
+		int fd = open(logName.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+		flock(fd, LOCK_EX);
+		std::vector<PuyoScoreEntry> entries;
+		ReadLog(fd, entries);
+		bool compacted = entries.empty();
+		if (!compacted)
+		{
+			std::stable_sort(entries.begin(), entries.end(), Higher);
+			PuyoScoreboard old;
+			std::vector<PuyoScoreEntry> merged;
+			if (old.Open(snapshotName))
+			{
+				merged.reserve(old.GetCount() + entries.size());
+				size_t j = 0;
+				for (size_t i = 0; i < old.GetCount(); i++)
+				{
+					while (j < entries.size() && entries[j].score > old.Get(i).score)
+					{
+						merged.push_back(entries[j++]);
+					}
+					merged.push_back(old.Get(i));
+				}
+				merged.insert(merged.end(), entries.begin() + j, entries.end());
+				old.Close();
+
+				compacted = PuyoScoreboard::Write(temporaryName, merged) &&
+							rename(temporaryName.c_str(), snapshotName.c_str()) == 0 &&
+							ftruncate(fd, 0) == 0;
+			}
+		}
+		flock(fd, LOCK_UN);
+		close(fd);
+		return compacted;
+	}
+
+private:
+	std::string snapshotName;
+	std::string logName;
+	PuyoScoreboard snapshot;
+	// ログのレコード (点数の高い順)
+	std::vector<PuyoScoreEntry> log;
+	size_t logCount;
+	std::thread compactor;
+	std::atomic<bool> compacting{false};
+
+	static bool Higher(const PuyoScoreEntry &a, const PuyoScoreEntry &b)
+	{
+		return a.score > b.score;
+	}
+
+	// score以上のログの件数
+	size_t CountLog(int score) const
+	{
+		size_t low = 0;
+		size_t high = logCount;
+		while (low < high)
+		{
+			size_t middle = low + (high - low) / 2;
+			if (log[middle].score >= score)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low;
+	}
+
+	// ログを全部読む (書きかけの末尾は捨てる)
+	static void ReadLog(int fd, std::vector<PuyoScoreEntry> &entries)
+	{
+		entries.clear();
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			return;
+		}
+		entries.resize(st.st_size / sizeof(PuyoScoreEntry));
+		size_t size = entries.size() * sizeof(PuyoScoreEntry);
+		if (size > 0 && pread(fd, &entries[0], size, 0) != (ssize_t)size)
+		{
+			entries.clear();
+		}
+	}
+};
+
+#endif